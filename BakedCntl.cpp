@@ -0,0 +1,141 @@
+#include <cassert>
+#include <limits>
+
+#include <QtMath>
+
+#include "BakedCntl.h"
+
+bool BakedCntl::Bake(SugenoCntl &cntl, double x_min, double x_max, double max_error, InterpType interp_type,
+                     int max_segments_cnt)
+{
+    assert(x_min < x_max);
+    assert(0 < max_error);
+    assert(0 < max_segments_cnt);
+    _interp_type = interp_type;
+    _x_min = x_min;
+    _x_max = x_max;
+    _segments_cnt = 0;
+    _max_error = std::numeric_limits<double>::infinity();
+    if (cntl.HasFuncRules() == true) return false;
+
+    //Более грубая сетка не разрешает самое узкое правило, и граница на ней заведомо не достигается
+    const double min_resolved_segments_cnt = (x_max - x_min) * _NODES_PER_MIN_RULE_WIDTH / cntl.MinRuleWidth();
+    int segments_cnt = _MIN_SEGMENTS_CNT;
+    if (max_segments_cnt < segments_cnt) segments_cnt = max_segments_cnt;
+    while (segments_cnt < min_resolved_segments_cnt && 2*segments_cnt <= max_segments_cnt) {
+        segments_cnt *= 2;
+    }
+
+    const ExpAccuracy exp_accuracy = cntl.GetExpAccuracy();
+    const bool is_lookup_sparse = cntl.IsRuleLookupSparse();
+    cntl.SetExpAccuracy(eaEXACT);
+    if (is_lookup_sparse == true) cntl.SetSparseRuleLookup(false, cntl.GetNormalEps());
+
+    QVector<double> node_xs, node_vals, check_xs, check_vals;
+    bool is_baked = false;
+    for (; ; segments_cnt *= 2) {
+        _segments_cnt = segments_cnt;
+        const double step = (x_max - x_min) / segments_cnt;
+        _inv_step = 1 / step;
+
+        node_xs.resize(segments_cnt + 1);
+        node_vals.resize(segments_cnt + 1);
+        for (int i = 0; i <= segments_cnt; ++i) {
+            node_xs[i] = x_min + i*step;
+        }
+        cntl.Evaluate(node_xs.constData(), node_vals.data(), node_xs.size());
+        BuildCoefs(node_vals);
+
+        check_xs.resize(segments_cnt * _CHECK_POINTS_PER_SEGMENT);
+        for (int segment = 0; segment < segments_cnt; ++segment) {
+            for (int i = 0; i < _CHECK_POINTS_PER_SEGMENT; ++i) {
+                double t = double(i + 1) / (_CHECK_POINTS_PER_SEGMENT + 1);
+                check_xs[segment*_CHECK_POINTS_PER_SEGMENT + i] = node_xs[segment] + t*step;
+            }
+        }
+        check_vals.resize(check_xs.size());
+        cntl.Evaluate(check_xs.constData(), check_vals.data(), check_xs.size());
+        _max_error = 0;
+        for (int segment = 0; segment < segments_cnt; ++segment) {
+            _max_error = qMax(_max_error, CalcSegmentErrorBound(cntl, segment, step, node_vals,
+                                                                check_vals.constData() + segment*_CHECK_POINTS_PER_SEGMENT));
+        }
+
+        is_baked = (_max_error <= max_error);
+        if (is_baked == true || max_segments_cnt < 2*segments_cnt) break;
+    }
+
+    cntl.SetExpAccuracy(exp_accuracy);
+    if (is_lookup_sparse == true) cntl.SetSparseRuleLookup(true, cntl.GetNormalEps());
+    return is_baked;
+}
+
+double BakedCntl::CalcSegmentErrorBound(const SugenoCntl &cntl, int segment, double step,
+                                        const QVector<double> &node_vals, const double *check_vals) const
+{
+    /* Отклонение e = y - p известно в узлах и проверочных точках. Между соседними точками на расстоянии gap
+     |e| не больше наибольшего из значений в них плюс min(E1*gap/2, E2*gap^2/8), где E1 и E2 - границы |e'| и |e''|:
+     оценки через производную и через вторую производную (последняя недоступна у излома треугольной функции) */
+    const double *coefs = _coefs.constData() + _COEFS_PER_SEGMENT*segment;
+    auto poly = [coefs](double t) { return ((coefs[3]*t + coefs[2])*t + coefs[1])*t + coefs[0]; };
+    double max_point_error = qMax(qAbs(node_vals[segment] - poly(0)), qAbs(node_vals[segment + 1] - poly(1)));
+    for (int i = 0; i < _CHECK_POINTS_PER_SEGMENT; ++i) {
+        double t = double(i + 1) / (_CHECK_POINTS_PER_SEGMENT + 1);
+        max_point_error = qMax(max_point_error, qAbs(check_vals[i] - poly(t)));
+    }
+
+    const double x_begin = _x_min + segment*step;
+    double cntl_deriv1, cntl_deriv2;
+    cntl.CalcDerivBounds(x_begin, x_begin + step, cntl_deriv1, cntl_deriv2);
+    //Производные многочлена по x при t в [0, 1]: p' = (b + 2ct + 3dt^2)/step, p'' = (2c + 6dt)/step^2
+    const double table_deriv1 = (qAbs(coefs[1]) + 2*qAbs(coefs[2]) + 3*qAbs(coefs[3])) / step;
+    const double table_deriv2 = (2*qAbs(coefs[2]) + 6*qAbs(coefs[3])) / (step*step);
+    const double gap = step / (_CHECK_POINTS_PER_SEGMENT + 1);
+    return max_point_error + qMin((cntl_deriv1 + table_deriv1) * gap/2, (cntl_deriv2 + table_deriv2) * gap*gap/8);
+}
+
+void BakedCntl::BuildCoefs(const QVector<double> &node_vals)
+{
+    const int nodes_cnt = node_vals.size();
+    _coefs.resize(_COEFS_PER_SEGMENT * _segments_cnt);
+    //Производные по t в узлах: центральные разности, на краях - односторонние второго порядка
+    auto node_slope = [&node_vals, nodes_cnt](int node)->double {
+        if (node == 0) return (-3*node_vals[0] + 4*node_vals[1] - node_vals[2]) / 2;
+        if (node == nodes_cnt - 1) return (3*node_vals[node] - 4*node_vals[node - 1] + node_vals[node - 2]) / 2;
+        return (node_vals[node + 1] - node_vals[node - 1]) / 2;
+    };
+    for (int segment = 0; segment < _segments_cnt; ++segment) {
+        double *coefs = _coefs.data() + _COEFS_PER_SEGMENT*segment;
+        double p0 = node_vals[segment], p1 = node_vals[segment + 1];
+        if (_interp_type == itLINEAR) {
+            coefs[0] = p0;
+            coefs[1] = p1 - p0;
+            coefs[2] = coefs[3] = 0;
+        } else {
+            //Кубический многочлен Эрмита по значениям и производным на концах отрезка
+            double m0 = node_slope(segment), m1 = node_slope(segment + 1);
+            coefs[0] = p0;
+            coefs[1] = m0;
+            coefs[2] = 3*(p1 - p0) - 2*m0 - m1;
+            coefs[3] = 2*(p0 - p1) + m0 + m1;
+        }
+    }
+}
+
+double BakedCntl::operator()(double x)
+{
+    _validity_flag = (_x_min <= x && x <= _x_max);
+    return Value(x);
+}
+
+bool BakedCntl::IsLastResValid() const
+{
+    return _validity_flag;
+}
+
+void BakedCntl::Evaluate(const double *xs, double *ys, int points_cnt) const
+{
+    for (int i = 0; i < points_cnt; ++i) {
+        ys[i] = Value(xs[i]);
+    }
+}
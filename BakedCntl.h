@@ -0,0 +1,67 @@
+#ifndef BAKEDCNTL_H
+#define BAKEDCNTL_H
+
+#include <cassert>
+
+#include <QVector>
+#include <QtGlobal>
+
+#include "UnaryFuncBase.h"
+#include "SugenoCntl.h"
+
+//Контроллер, заменённый таблицей на равномерной сетке: вычисление - один индекс и интерполяция
+class BakedCntl : public UnaryFuncBase
+{
+public:
+    enum InterpType { itLINEAR, itCUBIC };
+
+    /* Табличное представление cntl на [x_min, x_max] с гарантированной границей отклонения max_error.
+     Число отрезков удваивается, пока граница не станет не больше max_error. На каждом отрезке отклонение
+     вычисляется в узлах и трёх внутренних точках, а между ними оценивается через границы |y'| и |y''| контроллера
+     (SugenoCntl::CalcDerivBounds) и многочлена таблицы. Граница относится к точному вычислению cntl:
+     на время построения приближённая экспонента и поиск по носителям отключаются. Начальная сетка -
+     не грубее 1/_NODES_PER_MIN_RULE_WIDTH ширины самого узкого правила (SugenoCntl::MinRuleWidth).
+     Для правил, заданных UnaryFunc, граница не выводится: таблица не строится и возвращается false.
+     Если граница не достигнута при max_segments_cnt отрезках, остаётся последняя таблица и возвращается false */
+    bool Bake(SugenoCntl &cntl, double x_min, double x_max, double max_error, InterpType interp_type = itCUBIC,
+              int max_segments_cnt = 1 << 20);
+
+    double operator()(double x) override;
+    bool IsLastResValid() const override;
+    //Без обновления признака корректности; вне [x_min, x_max] - значение на ближайшем конце
+    double Value(double x) const
+    {
+        assert(0 < _segments_cnt);
+        double pos = qBound(0.0, (x - _x_min) * _inv_step, double(_segments_cnt));
+        int segment = qMin(int(pos), _segments_cnt - 1);
+        double t = pos - segment;
+        const double *coefs = _coefs.constData() + _COEFS_PER_SEGMENT*segment;
+        return ((coefs[3]*t + coefs[2])*t + coefs[1])*t + coefs[0];
+    }
+    void Evaluate(const double *xs, double *ys, int points_cnt) const;
+
+    //Граница отклонения от исходного контроллера на [x_min, x_max] (см. Bake)
+    double GetMaxError() const { return _max_error; }
+    int SegmentsCnt() const { return _segments_cnt; }
+
+private:
+    void BuildCoefs(const QVector<double> &node_vals);
+    //check_vals - значения cntl во внутренних проверочных точках отрезка
+    double CalcSegmentErrorBound(const SugenoCntl &cntl, int segment, double step, const QVector<double> &node_vals,
+                                 const double *check_vals) const;
+
+    //Многочлен от t в [0, 1] на каждом отрезке: a + b*t + c*t^2 + d*t^3 (для линейной интерполяции c = d = 0)
+    static const int _COEFS_PER_SEGMENT = 4;
+    static const int _MIN_SEGMENTS_CNT = 64;
+    static const int _CHECK_POINTS_PER_SEGMENT = 3;
+    static const int _NODES_PER_MIN_RULE_WIDTH = 8;
+
+    InterpType _interp_type = itCUBIC;
+    double _x_min = 0, _x_max = 0, _inv_step = 0;
+    int _segments_cnt = 0;
+    double _max_error = 0;
+    QVector<double> _coefs;
+    bool _validity_flag = false;
+};
+
+#endif // BAKEDCNTL_H
@@ -1,5 +1,7 @@
 #include <cassert>
 #include <algorithm>
+#include <map>
+#include <mutex>
 
 #include <QDebug>
 #include <QtMath>
@@ -8,6 +10,8 @@
 
 #include "CntlBuilder.h"
 
+const int CntlBuilder::_ROWS_BLOCK_SIZE;
+
 void CntlBuilder::SetData(UnaryFunc &f, double x_min, double x_max, double step)
 {
     assert(0 < step);
@@ -15,13 +19,15 @@ void CntlBuilder::SetData(UnaryFunc &f, double x_min, double x_max, double step)
     assert(1 < points_cnt);
 
     double x_of_max_abs = x_min, max_abs_y = qAbs( f(x_min) );
-    _input_points.resize(points_cnt);
+    _input_x.resize(points_cnt);
+    _input_y.resize(points_cnt);
     for (int i = 0; i < points_cnt; ++i) {
         double x = x_min + i*step;
         double y = f(x);
         y = (f.IsLastResValid() == true)? y: 0;
         //повторы во входной последовательности значений не отслеживаются!
-        _input_points[i] = PointInfo(x,y,false);
+        _input_x[i] = x;
+        _input_y[i] = y;
         if (max_abs_y < qAbs(y)) {
             x_of_max_abs = x;
             max_abs_y = qAbs(y);
@@ -38,11 +44,11 @@ void CntlBuilder::SetData(const QVector<double> &x_vals, const QVector<double> &
     assert(y_vals.size() == x_vals.size());
 
     double x_of_max_abs = x_vals[0], max_abs_y = qAbs( y_vals[0] );
-    _input_points.resize(x_vals.size());
+    _input_x = x_vals;
+    _input_y = y_vals;
     for (int i = 0; i < x_vals.size(); ++i) {
         double x = x_vals[i], y = y_vals[i];
         //повторы во входной последовательности значений не отслеживаются!
-        _input_points[i] = PointInfo(x,y,false);
         if (max_abs_y < qAbs(y)) {
             x_of_max_abs = x;
             max_abs_y = qAbs(y);
@@ -56,10 +62,11 @@ double CntlBuilder::CalcSumError()
 {
     /* Суммарная ошибка считается на основе входных точек (не изменённых в процессе обучения!)
      и выхода контроллера */
+    QVector<double> y_cntl_vals(_input_x.size());
+    _cntl.Evaluate(_input_x.constData(), y_cntl_vals.data(), _input_x.size());
     double sum_error(0);
-    for (int i = 0; i < _input_points.size(); ++i) {
-        double x = _input_points[i].x, y = _input_points[i].y;
-        double y_cntl = _cntl(x);
+    for (int i = 0; i < _input_x.size(); ++i) {
+        double y = _input_y[i], y_cntl = y_cntl_vals[i];
         sum_error += (y - y_cntl)*(y - y_cntl);
     }
     return sum_error;
@@ -67,85 +74,158 @@ double CntlBuilder::CalcSumError()
 
 void CntlBuilder::GetInputPointsX(QVector<double> &x_vals) const
 {
-    x_vals.resize(_input_points.size());
-    for (int i = 0; i < _input_points.size(); ++i) {
-        x_vals[i] = _input_points[i].x;
-    }
+    x_vals = _input_x;
 }
 
 void CntlBuilder::GetInputPointsY(QVector<double> &y_vals) const
 {
-    y_vals.resize(_input_points.size());
-    for (int i = 0; i < _input_points.size(); ++i) {
-        y_vals[i] = _input_points[i].y;
-    }
+    y_vals = _input_y;
 }
 
 void CntlBuilder::GetRestInputPointsX(QVector<double> &x_vals) const
 {
-    x_vals.clear();
-    for (int i = 0; i < _input_points.size(); ++i) {
-        if (_input_points[i].is_removed == false) {
-            x_vals.push_back(_input_points[i].x);
-        }
+    //Рабочий набор может ещё содержать точки, удалённые на последнем шаге
+    x_vals.resize(_not_removed_points_cnt);
+    int rest_id = 0;
+    for (int i = 0; i < _rest_points_ids.size(); ++i) {
+        if (_is_point_removed[_rest_points_ids[i]] == false) x_vals[rest_id++] = _rest_points_x[i];
     }
 }
 
 void CntlBuilder::GetRestInputPointsY(QVector<double> &y_vals) const
 {
-    y_vals.clear();
-    for (int i = 0; i < _input_points.size(); ++i) {
-        if (_input_points[i].is_removed == false) {
-            y_vals.push_back(_input_points[i].y);
-        }
+    y_vals.resize(_not_removed_points_cnt);
+    int rest_id = 0;
+    for (int i = 0; i < _rest_points_ids.size(); ++i) {
+        if (_is_point_removed[_rest_points_ids[i]] == false) y_vals[rest_id++] = _rest_points_y[i];
     }
 }
 
 void CntlBuilder::GetRecogLinePoints(QVector<double> &x_vals, QVector<double> &y_vals) const
 {
-    x_vals.resize(_recog_line_points_ptrs.size());
-    y_vals.resize(_recog_line_points_ptrs.size());
-    for (int i = 0; i < _recog_line_points_ptrs.size(); ++i) {
-        x_vals[i] = _recog_line_points_ptrs[i]->x;
-        y_vals[i] = _recog_line_points_ptrs[i]->y;
+    x_vals.resize(_recog_line_points_ids.size());
+    y_vals.resize(_recog_line_points_ids.size());
+    for (int i = 0; i < _recog_line_points_ids.size(); ++i) {
+        x_vals[i] = _input_x[_recog_line_points_ids[i]];
+        y_vals[i] = _input_y[_recog_line_points_ids[i]];
     }
 }
 
+void CntlBuilder::SetThreadsCnt(int threads_cnt)
+{
+    _hough.SetThreadsCnt(threads_cnt);
+    _thread_pool.SetThreadsCnt(threads_cnt);
+}
+
+void CntlBuilder::SetHoughAngleRange(double min_angle_in_degr, double max_angle_in_degr, int angles_cnt)
+{
+    _hough.SetAngleRange(min_angle_in_degr, max_angle_in_degr, angles_cnt);
+    _is_hough_table_actual = false;
+    _pending_peaks.clear();
+}
+
+void CntlBuilder::SetHoughRadiusStep(double radius_step)
+{
+    //Явно заданный шаг не ограничивается диапазоном по умолчанию
+    _hough.SetRadiusStepRange(qMin(radius_step, _hough.GetMinRadiusStep()), qMax(radius_step, _hough.GetMaxRadiusStep()));
+    _hough.SetRadiusStep(radius_step);
+    _is_hough_table_actual = false;
+    _pending_peaks.clear();
+}
+
+void CntlBuilder::SetHoughSampling(double sample_fraction, unsigned seed)
+{
+    assert(0 < sample_fraction && sample_fraction <= 1);
+    _hough_sample_fraction = sample_fraction;
+    _hough.SetRandomSeed(seed);
+    _is_hough_table_actual = false;
+    _pending_peaks.clear();
+}
+
+void CntlBuilder::SetHoughOrientedVoting(double window_in_degr, int normal_half_window)
+{
+    assert(0 < normal_half_window);
+    _hough.SetOrientedVoting(window_in_degr);
+    _is_voting_oriented = (0 < window_in_degr);
+    _normal_half_window = normal_half_window;
+    _normal_angles_in_degr.clear();
+    _is_hough_table_actual = false;
+    _pending_peaks.clear();
+}
+
+void CntlBuilder::SetExpAccuracy(ExpAccuracy accuracy)
+{
+    _exp_accuracy = accuracy;
+    _cntl.SetExpAccuracy(accuracy);
+}
+
+void CntlBuilder::SetPickBandWidth(double band_width)
+{
+    assert(0 <= band_width);
+    _pick_band_width = band_width;
+}
+
+void CntlBuilder::SetHoughPeaksPerPass(int peaks_cnt, double min_angle_dist_in_degr, double min_radius_dist,
+                                       double min_rel_votes)
+{
+    assert(1 <= peaks_cnt);
+    assert(0 <= min_rel_votes && min_rel_votes <= 1);
+    _hough_peaks_per_pass = peaks_cnt;
+    _hough_peaks_min_angle_dist = min_angle_dist_in_degr;
+    _hough_peaks_min_radius_dist = min_radius_dist;
+    _hough_peaks_min_rel_votes = min_rel_votes;
+    _pending_peaks.clear();
+}
+
 bool CntlBuilder::BuildNextMemFunc()
 {
     if (_is_ready_to_build == false) return false;
 
-    if (_not_removed_points_cnt < MIN_POINTS_FOR_LINE_DEF) {
-        qDebug() << "It remains too few points!";
-        return false; //Условие остановки обучения
-    }
+    _step_retries_cnt = 0;
+    _step_votings_cnt = 0;
+    /* Повторные попытки выполняются в цикле, а не рекурсивно: глубина стека не зависит от входных данных.
+     Таблица Хафа при повторе не пересоздаётся, голоса отброшенных точек из неё вычитаются */
+    while (true) {
+        if (_not_removed_points_cnt < MIN_POINTS_FOR_LINE_DEF) {
+            qDebug() << "It remains too few points!";
+            return false; //Условие остановки обучения
+        }
 
-    RecogNextLine();
+        RecogNextLine();
 
-    PickPointsFromRecogLine();
+        PickPointsFromRecogLine();
 
-    if (_have_to_use_filter == true) {
-        FilterRecogLinePoints();
-    }
+        if (_have_to_use_filter == true) {
+            FilterRecogLinePoints();
+        }
+
+        if (MIN_POINTS_FOR_LINE_DEF < _recog_line_points_ids.size()) {
+            _repeated_calls = 0;
+            break;
+        }
+        if (_is_recog_line_from_queue == true) {
+            //Максимум из очереди устарел: шаг повторяется по главному максимуму без учёта попытки
+            _pending_peaks.clear();
+            continue;
+        }
 
-    if (_recog_line_points_ptrs.size() <= MIN_POINTS_FOR_LINE_DEF) {
+        ++_step_retries_cnt;
         if (_repeated_calls < MAX_REPEATED_CALLS) {
             ++_repeated_calls;
             qDebug() << "repeated calls: " << _repeated_calls;
+            //Точки неудачной прямой отбрасываются, следующая попытка ищет другую прямую
             MarkPointsFromRecogLineAsRemoved();
-            return BuildNextMemFunc(); //Рекурсивный вызов
+        } else if (_have_to_use_filter == true) {
+            _have_to_use_filter = false;
+            _repeated_calls = 0;
+            qDebug() << "filter was disabled!";
         } else {
-            if (_have_to_use_filter == true) {
-                _have_to_use_filter = false;
-                _repeated_calls = 0;
-                qDebug() << "filter was disabled!";
-                return BuildNextMemFunc(); //Рекурсивный вызов
-            } else {
-                return false;   //Остановка обучения
-            }
+            return false;   //Остановка обучения
         }
-    } else {
-        _repeated_calls = 0;
+    }
+
+    if (_is_recog_line_refined == true) {
+        RefitRecogLine();
     }
 
     BuildMemFunc();
@@ -164,48 +244,128 @@ void CntlBuilder::BuildCntl()
 
     if (_mem_funcs.size() == 0) return;
 
-    const int n_rows_in_A = _input_points.size(),
+    //Решение системы уравнений
+    QVector<double> X = (_solver_type == stDENSE)? SolveCntlSystemDense(): SolveCntlSystemByBlocks();
+
+    //Добавление правил: функции принадлежности и следствия параметрические, контроллер хранит их в плоских массивах
+    for (int i = 0; i < _mem_funcs.size(); ++i) {
+        int a_id = 2*i, b_id = 2*i+1;
+        double a = X[a_id], b = X[b_id];
+        _cntl.AddRule(_mem_funcs[i], a, b);
+    }
+}
+
+QVector<double> CntlBuilder::SolveCntlSystemDense()
+{
+    const int n_rows_in_A = _input_x.size(),
               n_cols_in_A = 2 * _mem_funcs.size();
     arma::mat A(n_rows_in_A, n_cols_in_A);
     arma::vec B(n_rows_in_A);
 
-    //Заполнение A
-    for (int row = 0; row < A.n_rows; ++row) {
-        int point_id = row;
-        double x = _input_points[point_id].x;
-        double mem_funcs_sum = 0;
-        for (int i = 0; i < _mem_funcs.size(); ++i) {
-            mem_funcs_sum += _mem_funcs[i](x);
-        }
-        for (int col = 0; col < A.n_cols; ++col) {
-            int mem_func_id = col / 2;
-            double value = _mem_funcs[mem_func_id](x) / mem_funcs_sum;
-            value = (col % 2 == 0)? value * x: value;
-            A(row,col) = value;
-        }
-    }
+    //Заполнение A: блоки строк независимы и делятся между потоками
+    double *a_data = A.memptr();
+    _thread_pool.ParallelFor(0, n_rows_in_A, [this, n_rows_in_A, a_data](int row_begin, int row_end) {
+        FillCntlSystemRows(row_begin, row_end, a_data, n_rows_in_A, 0);
+    });
 
     //Заполнение B
-    for (int row = 0; row < B.n_rows; ++row) {
-        int point_id = row;
-        B(row) = _input_points[point_id].y;
-    }
+    std::copy(_input_y.begin(), _input_y.end(), B.memptr());
 
-    //Решение системы уравнений
     arma::vec X = solve(A,B);
+    QVector<double> result(n_cols_in_A);
+    std::copy(X.memptr(), X.memptr() + n_cols_in_A, result.begin());
+    return result;
+}
 
-    //Формирование следствий правил
-    QVector<UnaryFunc> conseq_funcs(_mem_funcs.size());
-    for (int i = 0; i < conseq_funcs.size(); ++i) {
-        int a_id = 2*i, b_id = 2*i+1;
-        double a = X(a_id), b = X(b_id);
-        UnaryFunc conseq_func = std::function<double(double)>([a,b](double x)->double { return a*x + b; });
-        conseq_funcs[i] = conseq_func;
+QVector<double> CntlBuilder::SolveCntlSystemByBlocks()
+{
+    /* Строки системы формируются блоками по _ROWS_BLOCK_SIZE в расширенной матрице [A | B] и сразу сворачиваются
+     в квадратную матрицу размера 2m+1: для нормальных уравнений накапливается [A | B]^T [A | B],
+     для TSQR - множитель R из QR-разложения уже обработанных строк. Полная матрица A не хранится.
+     Каждый поток сворачивает свою часть строк, затем части объединяются в порядке номеров строк,
+     чтобы результат не зависел от того, какой поток закончил первым */
+    const int rows_cnt = _input_x.size(),
+              n_cols_in_A = 2 * _mem_funcs.size(),
+              n_cols_in_AB = n_cols_in_A + 1;
+    const bool is_tsqr = (_solver_type == stTSQR);
+
+    std::mutex parts_mutex;
+    std::map<int, arma::mat> parts;
+    _thread_pool.ParallelFor(0, rows_cnt, [&](int row_begin, int row_end) {
+        arma::mat acc, block;
+        if (!is_tsqr) acc.zeros(n_cols_in_AB, n_cols_in_AB);
+        for (int block_begin = row_begin; block_begin < row_end; block_begin += _ROWS_BLOCK_SIZE) {
+            const int block_size = qMin(_ROWS_BLOCK_SIZE, row_end - block_begin);
+            block.set_size(block_size, n_cols_in_AB);
+            FillCntlSystemRows(block_begin, block_begin + block_size, block.memptr(), block_size, block_begin);
+            std::copy(_input_y.constData() + block_begin, _input_y.constData() + block_begin + block_size,
+                      block.colptr(n_cols_in_A));
+            if (is_tsqr) {
+                arma::mat Q, R;
+                qr_econ(Q, R, arma::join_cols(acc, block));
+                acc = R;
+            } else {
+                acc += block.t() * block;
+            }
+        }
+        std::lock_guard<std::mutex> lock(parts_mutex);
+        parts[row_begin] = acc;
+    });
+
+    arma::mat acc;
+    if (!is_tsqr) acc.zeros(n_cols_in_AB, n_cols_in_AB);
+    for (auto it = parts.begin(); it != parts.end(); ++it) {
+        if (is_tsqr) {
+            arma::mat Q, R;
+            qr_econ(Q, R, arma::join_cols(acc, it->second));
+            acc = R;
+        } else {
+            acc += it->second;
+        }
     }
 
-    //Добавление правил
-    for (int i = 0; i < _mem_funcs.size(); ++i) {
-        _cntl.AddRule(_mem_funcs[i], conseq_funcs[i]);
+    /* Для нормальных уравнений A^T A X = A^T B. Для TSQR: [A | B] = Q R, откуда R_AA X = R_AB.
+     Если точек меньше, чем столбцов, R содержит меньше строк - недостающие уравнения нулевые */
+    arma::mat lhs(n_cols_in_A, n_cols_in_A, arma::fill::zeros);
+    arma::vec rhs(n_cols_in_A, arma::fill::zeros);
+    const int filled_rows_cnt = qMin<int>(acc.n_rows, n_cols_in_A);
+    for (int row = 0; row < filled_rows_cnt; ++row) {
+        for (int col = 0; col < n_cols_in_A; ++col) {
+            lhs(row, col) = acc(row, col);
+        }
+        rhs(row) = acc(row, n_cols_in_A);
+    }
+    arma::vec X = solve(lhs, rhs);
+    QVector<double> result(n_cols_in_A);
+    std::copy(X.memptr(), X.memptr() + n_cols_in_A, result.begin());
+    return result;
+}
+
+void CntlBuilder::FillCntlSystemRows(int row_begin, int row_end, double *a_data, int a_rows_cnt, int a_first_row)
+{
+    /* Матрица Armadillo хранится по столбцам, поэтому блок заполняется столбец за столбцом.
+     Каждая функция принадлежности вычисляется один раз на точку: значение пишется сразу в столбец 2*i + 1
+     и затем используется и для суммы, и для столбца 2*i */
+    double mem_funcs_sums[_ROWS_BLOCK_SIZE];
+    for (int block_begin = row_begin; block_begin < row_end; block_begin += _ROWS_BLOCK_SIZE) {
+        const int block_size = qMin(_ROWS_BLOCK_SIZE, row_end - block_begin);
+        const double *xs = _input_x.constData() + block_begin;
+        std::fill(mem_funcs_sums, mem_funcs_sums + block_size, 0.0);
+        for (int i = 0; i < _mem_funcs.size(); ++i) {
+            double *m_vals = a_data + size_t(2*i + 1)*a_rows_cnt + (block_begin - a_first_row);
+            _mem_funcs[i].Values(xs, block_size, m_vals, _exp_accuracy);
+            for (int row = 0; row < block_size; ++row) {
+                mem_funcs_sums[row] += m_vals[row];
+            }
+        }
+        for (int i = 0; i < _mem_funcs.size(); ++i) {
+            double *x_col = a_data + size_t(2*i)*a_rows_cnt + (block_begin - a_first_row),
+                   *one_col = a_data + size_t(2*i + 1)*a_rows_cnt + (block_begin - a_first_row);
+            for (int row = 0; row < block_size; ++row) {
+                one_col[row] /= mem_funcs_sums[row];
+                x_col[row] = one_col[row] * xs[row];
+            }
+        }
     }
 }
 
@@ -220,13 +380,14 @@ void CntlBuilder::BuildAll()
 
 QVector<CntlBuilder::DistCluster> CntlBuilder::KMeansByDist()
 {
-    assert(MIN_POINTS_FOR_LINE_DEF <= _recog_line_points_ptrs.size());
+    assert(MIN_POINTS_FOR_LINE_DEF <= _recog_line_points_ids.size());
 
-    //исходный контейнер точек отсортирован => отсортирован контейнер с указателями
-    QVector<double> dist_vals(_recog_line_points_ptrs.size() - 1);
+    //исходные точки отсортированы, номера возрастают => точки прямой отсортированы
+    QVector<double> dist_vals(_recog_line_points_ids.size() - 1);
     for (int i = 0; i < dist_vals.size(); ++i) {
-        double x1 = _recog_line_points_ptrs[i]->x, y1 = _recog_line_points_ptrs[i]->y,
-               x2 = _recog_line_points_ptrs[i + 1]->x, y2 = _recog_line_points_ptrs[i + 1]->y;
+        int id1 = _recog_line_points_ids[i], id2 = _recog_line_points_ids[i + 1];
+        double x1 = _input_x[id1], y1 = _input_y[id1],
+               x2 = _input_x[id2], y2 = _input_y[id2];
         double dist = qSqrt( (x2 - x1)*(x2 - x1) + (y2 - y1)*(y2 - y1) );
         dist_vals[i] = dist;
     }
@@ -300,52 +461,185 @@ void CntlBuilder::PrepareToLearning(double x_of_max_abs_y, double max_abs_y)
 {
     assert(0 <= max_abs_y);
 
-    _hough.Init(x_of_max_abs_y, max_abs_y);
-    AscSortPointsByX(_input_points);
-    _not_removed_points_cnt = _input_points.size();
+    _hough.Init(x_of_max_abs_y, max_abs_y, _hough.GetRadiusStep());
+    AscSortPointsByX();
+    _normal_angles_in_degr.clear();
+    _is_point_removed.fill(false, _input_x.size());
+    _not_removed_points_cnt = _input_x.size();
+    _rest_points_x = _input_x;
+    _rest_points_y = _input_y;
+    _rest_points_ids.resize(_input_x.size());
+    for (int i = 0; i < _rest_points_ids.size(); ++i) {
+        _rest_points_ids[i] = i;
+    }
     _mem_funcs.clear();
     _cntl.Clear();
     _steps_done = 0;
 
     _repeated_calls = 0;
+    _step_retries_cnt = 0;
+    _step_votings_cnt = 0;
     _have_to_use_filter = true;
+    _is_hough_table_actual = false;
+    _pending_peaks.clear();
 
     _is_ready_to_build = true;
 }
 
+void CntlBuilder::CompactRestPoints()
+{
+    if (_rest_points_ids.size() == _not_removed_points_cnt) return;
+
+    /* Удалённые точки вытесняются из рабочего набора на месте, порядок по x сохраняется.
+     Просматривается только рабочий набор, поэтому стоимость шага падает вместе с числом оставшихся точек */
+    int rest_id = 0;
+    for (int i = 0; i < _rest_points_ids.size(); ++i) {
+        int point_id = _rest_points_ids[i];
+        if (_is_point_removed[point_id] == true) continue;
+        _rest_points_x[rest_id] = _rest_points_x[i];
+        _rest_points_y[rest_id] = _rest_points_y[i];
+        _rest_points_ids[rest_id] = point_id;
+        ++rest_id;
+    }
+    assert(rest_id == _not_removed_points_cnt);
+    _rest_points_x.resize(rest_id);
+    _rest_points_y.resize(rest_id);
+    _rest_points_ids.resize(rest_id);
+}
+
 void CntlBuilder::RecogNextLine()
 {
-    _hough.Clear();
-    for (int i = 0; i < _input_points.size(); ++i) {
-        if (_input_points[i].is_removed == false) {
-            double x = _input_points[i].x, y = _input_points[i].y;
-            _hough.AddPoint(x,y);
+    CompactRestPoints();
+    /* Очередь проверяется по таблице, из которой вычитаются голоса удалённых точек. Максимум, точки которого
+     забрали предыдущие прямые, отбрасывается без попытки выбора и не считается повторной попыткой */
+    if (_is_hough_table_actual == false) _pending_peaks.clear();
+    while (_pending_peaks.isEmpty() == false
+           && _hough.IsPeakLive(_pending_peaks.first(), _hough_peaks_min_rel_votes) == false) {
+        _pending_peaks.removeFirst();
+    }
+    _is_recog_line_from_queue = (_pending_peaks.isEmpty() == false);
+    if (_is_recog_line_from_queue == true) {
+        /* Прямая найдена на одном из предыдущих шагов; точки, удалённые с тех пор, в выбор не попадут,
+         так как принадлежность проверяется только для неудалённых точек */
+        _hough.SelectPeak(_pending_peaks.takeFirst());
+    } else {
+        VoteRestPoints();
+        //Таблица случайной выборки пересоздаётся на каждом шаге, очередь для неё не ведётся
+        if (1 < _hough_peaks_per_pass && _is_hough_table_actual == true) {
+            _hough.FindPeaks(_hough_peaks_per_pass, _hough_peaks_min_angle_dist, _hough_peaks_min_radius_dist,
+                             _hough_peaks_min_rel_votes, _pending_peaks);
+            //Первый максимум - главный, остальные ждут следующих шагов
+            if (_pending_peaks.isEmpty() == false) _hough.SelectPeak(_pending_peaks.takeFirst());
         }
     }
+    if (1 < _hough_refine_factor) {
+        _hough.RefineResult(_rest_points_x.constData(), _rest_points_y.constData(), nullptr, _rest_points_x.size(),
+                            _hough_refine_factor);
+    } else if (_is_recog_line_refined == true) {
+        _hough.InterpolateResult();
+    }
     _recog_line_angle_coef = _hough.GetLineAngleCoef();
     _recog_line_shift = _hough.GetLineShift();
 }
 
+void CntlBuilder::VoteRestPoints()
+{
+    const double *rest_normals = nullptr;
+    if (_is_voting_oriented == true) {
+        if (_normal_angles_in_degr.size() != _input_x.size()) EstimateNormalAngles();
+        //Нормали нужны только при голосовании, поэтому при сжатии рабочего набора не переносятся
+        _rest_points_normals.resize(_rest_points_ids.size());
+        for (int i = 0; i < _rest_points_ids.size(); ++i) {
+            _rest_points_normals[i] = _normal_angles_in_degr[_rest_points_ids[i]];
+        }
+        rest_normals = _rest_points_normals.constData();
+    }
+    if (_hough_sample_fraction < 1) {
+        //Таблица содержит голоса только случайной выборки, поэтому вычитать из неё удалённые точки нельзя
+        _hough.Clear();
+        ++_step_votings_cnt;
+        _hough.AddRandomPoints(_rest_points_x.constData(), _rest_points_y.constData(), _rest_points_x.size(),
+                               _hough_sample_fraction, rest_normals);
+    } else if (_is_hough_table_actual == false) {
+        //Полное голосование нужно только на первом шаге, далее голоса удалённых точек вычитаются
+        _hough.Clear();
+        ++_step_votings_cnt;
+        _hough.AddPoints(_rest_points_x.constData(), _rest_points_y.constData(), nullptr, _rest_points_x.size(),
+                         rest_normals);
+        _is_hough_table_actual = true;
+    }
+}
+
 void CntlBuilder::PickPointsFromRecogLine()
 {
-    _recog_line_points_ptrs.clear();
-    for (PointInfo &point: _input_points) {
-        double x = point.x, y = point.y;
-        if (point.is_removed == true) continue;
-        if (_hough.IsPointFromRecogLine(x,y) == true) {
-            _recog_line_points_ptrs.push_back(&point);
+    //Неудалённые точки собраны в RecogNextLine, проверка выполняется для всех сразу
+    _is_rest_point_from_line.resize(_rest_points_x.size());
+    if (0 < _pick_band_width) {
+        _hough.FindPointsNearRecogLine(_rest_points_x.constData(), _rest_points_y.constData(), _rest_points_x.size(),
+                                       _pick_band_width / 2, _is_rest_point_from_line.data());
+    } else {
+        _hough.FindPointsFromRecogLine(_rest_points_x.constData(), _rest_points_y.constData(), _rest_points_x.size(),
+                                       _is_rest_point_from_line.data());
+    }
+    _recog_line_points_ids.clear();
+    for (int i = 0; i < _rest_points_ids.size(); ++i) {
+        if (_is_rest_point_from_line[i] == true) {
+            _recog_line_points_ids.push_back(_rest_points_ids[i]);
         }
     }
 }
 
-void CntlBuilder::AscSortPointsByX(QVector<PointInfo> &points)
+void CntlBuilder::AscSortPointsByX()
+{
+    //Сортируется перестановка номеров, затем по ней переставляются оба массива
+    QVector<int> order(_input_x.size());
+    for (int i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [this](int id1, int id2)->bool { return _input_x[id1] < _input_x[id2]; });
+    QVector<double> sorted_x(order.size()), sorted_y(order.size());
+    for (int i = 0; i < order.size(); ++i) {
+        sorted_x[i] = _input_x[order[i]];
+        sorted_y[i] = _input_y[order[i]];
+    }
+    _input_x.swap(sorted_x);
+    _input_y.swap(sorted_y);
+}
+
+void CntlBuilder::EstimateNormalAngles()
 {
-    std::sort(points.begin(), points.end(), [](const PointInfo &p1, const PointInfo &p2)->bool { return p1.x < p2.x; });
+    /* Наклон в точке - наклон прямой наименьших квадратов по точкам i - _normal_half_window..i + _normal_half_window
+     (точки отсортированы по x): разность соседних точек на частой сетке определяется шумом, а не наклоном */
+    const int points_cnt = _input_x.size();
+    _normal_angles_in_degr.resize(points_cnt);
+    for (int i = 0; i < points_cnt; ++i) {
+        const int begin_id = qMax(0, i - _normal_half_window), end_id = qMin(points_cnt, i + _normal_half_window + 1);
+        double mean_x = 0, mean_y = 0;
+        for (int j = begin_id; j < end_id; ++j) {
+            mean_x += _input_x[j];
+            mean_y += _input_y[j];
+        }
+        mean_x /= end_id - begin_id;
+        mean_y /= end_id - begin_id;
+        double sxx = 0, sxy = 0, syy = 0;
+        for (int j = begin_id; j < end_id; ++j) {
+            double dx = _input_x[j] - mean_x, dy = _input_y[j] - mean_y;
+            sxx += dx*dx;
+            sxy += dx*dy;
+            syy += dy*dy;
+        }
+        //Направление прямой (sxx, sxy), нормаль к нему - (-sxy, sxx); при совпадающих x прямая вертикальна
+        if (0 < sxx) {
+            _normal_angles_in_degr[i] = qRadiansToDegrees(qAtan2(sxx, -sxy));
+        } else {
+            _normal_angles_in_degr[i] = (0 < syy)? 180: qQNaN();
+        }
+    }
 }
 
 void CntlBuilder::FilterRecogLinePoints()
 {
-    if (_recog_line_points_ptrs.size() < MIN_POINTS_FOR_LINE_DEF) return;
+    if (_recog_line_points_ids.size() < MIN_POINTS_FOR_LINE_DEF) return;
 
     QVector<DistCluster> dist_labels = KMeansByDist();
 
@@ -362,38 +656,79 @@ void CntlBuilder::FilterRecogLinePoints()
             start_pos = end_pos + 1;
         }
     }
-    end_pos = _recog_line_points_ptrs.size() - 1;
+    end_pos = _recog_line_points_ids.size() - 1;
     part_size = end_pos - start_pos + 1;
     if (ret_part_size < part_size) {
         ret_start_pos = start_pos;
         ret_part_size = part_size;
     }
 
-    _recog_line_points_ptrs = _recog_line_points_ptrs.mid(ret_start_pos, ret_part_size);
+    _recog_line_points_ids = _recog_line_points_ids.mid(ret_start_pos, ret_part_size);
+}
+
+void CntlBuilder::RefitRecogLine()
+{
+    //Прямая y = a*x + b по методу наименьших квадратов, координаты центрируются для устойчивости
+    const int points_cnt = _recog_line_points_ids.size();
+    if (points_cnt < MIN_POINTS_FOR_LINE_DEF) return;
+    double mean_x = 0, mean_y = 0;
+    for (int point_id: _recog_line_points_ids) {
+        mean_x += _input_x[point_id];
+        mean_y += _input_y[point_id];
+    }
+    mean_x /= points_cnt;
+    mean_y /= points_cnt;
+    double sxx = 0, sxy = 0;
+    for (int point_id: _recog_line_points_ids) {
+        double dx = _input_x[point_id] - mean_x, dy = _input_y[point_id] - mean_y;
+        sxx += dx*dx;
+        sxy += dx*dy;
+    }
+    //Все точки с одинаковым x: прямая вертикальна, остаётся результат преобразования Хафа
+    if (sxx <= 0) return;
+    _recog_line_angle_coef = sxy / sxx;
+    _recog_line_shift = mean_y - _recog_line_angle_coef * mean_x;
 }
 
 void CntlBuilder::BuildMemFunc()
 {
-    QVector<double> x_vals(_recog_line_points_ptrs.size());
+    QVector<double> x_vals(_recog_line_points_ids.size());
     for (int i = 0; i < x_vals.size(); ++i) {
-        x_vals[i] = _recog_line_points_ptrs[i]->x;
+        x_vals[i] = _input_x[_recog_line_points_ids[i]];
     }
     //Функция нормального распределения, контроллер получается всюду определённым
-    UnaryFunc m_func = SugenoCntl::GenNormalFunc(x_vals);
+    MemFuncParams m_func = SugenoCntl::CalcNormalParams(x_vals);
     _mem_funcs.push_back(m_func);
 }
 
 void CntlBuilder::MarkPointsFromRecogLineAsRemoved()
 {
+    //Номера точек прямой указывают прямо в массив признаков, просмотр всех входных точек не нужен
     int removed_points_cnt = 0;
-    for (PointInfo &point: _input_points) {
-        for (const PointInfo *point_ptr: _recog_line_points_ptrs) {
-            if (&point == point_ptr) {
-                point.is_removed = true;
-                ++removed_points_cnt;
-            }
+    for (int point_id: _recog_line_points_ids) {
+        if (_is_point_removed[point_id] == false) {
+            _is_point_removed[point_id] = true;
+            ++removed_points_cnt;
         }
     }
-    assert(removed_points_cnt == _recog_line_points_ptrs.size());
+    assert(removed_points_cnt == _recog_line_points_ids.size());
     _not_removed_points_cnt -= removed_points_cnt;
+
+    if (_is_hough_table_actual == true) {
+        QVector<double> removed_x(removed_points_cnt), removed_y(removed_points_cnt), removed_normals;
+        for (int i = 0; i < removed_points_cnt; ++i) {
+            int point_id = _recog_line_points_ids[i];
+            removed_x[i] = _input_x[point_id];
+            removed_y[i] = _input_y[point_id];
+        }
+        if (_is_voting_oriented == true) {
+            //Голоса вычитаются с теми же нормалями, с которыми точки голосовали
+            removed_normals.resize(removed_points_cnt);
+            for (int i = 0; i < removed_points_cnt; ++i) {
+                removed_normals[i] = _normal_angles_in_degr[_recog_line_points_ids[i]];
+            }
+        }
+        _hough.RemovePoints(removed_x.constData(), removed_y.constData(), nullptr, removed_points_cnt,
+                            (_is_voting_oriented == true)? removed_normals.constData(): nullptr);
+    }
 }
@@ -11,6 +11,10 @@ class CntlBuilder
 {
 public:
     enum DistCluster { dcSHORT, dcLONG };
+    /* Решение системы для следствий правил в BuildCntl: stDENSE - вся матрица n x 2m в памяти;
+     stNORMAL_EQUATIONS и stTSQR - строки обрабатываются блоками, память пропорциональна квадрату числа правил.
+     stTSQR (блочное QR-разложение) устойчивее нормальных уравнений при плохой обусловленности */
+    enum SolverType { stDENSE, stNORMAL_EQUATIONS, stTSQR };
 
     const int MIN_POINTS_FOR_LINE_DEF = 2;
     const int MAX_REPEATED_CALLS = 1;
@@ -29,46 +33,110 @@ public:
     double GetRecogLineShift() const { return _recog_line_shift; }
     SugenoCntl& GetController() { return _cntl; }
 
+    //Число потоков для голосования в преобразовании Хафа и построения системы уравнений; 0: по числу ядер
+    void SetThreadsCnt(int threads_cnt);
+    //Разрешение таблицы Хафа: диапазон и число углов, шаг радиуса
+    void SetHoughAngleRange(double min_angle_in_degr, double max_angle_in_degr, int angles_cnt);
+    void SetHoughRadiusStep(double radius_step);
+    //Уточнение прямой на локальной сетке в refine_factor раз мельче; 1: без уточнения
+    void SetHoughRefineFactor(int refine_factor) { _hough_refine_factor = refine_factor; }
+    //Вероятностное голосование случайной долей точек на каждом шаге; 1: голосуют все точки
+    void SetHoughSampling(double sample_fraction, unsigned seed = 0);
+    /* Направленное голосование: точка голосует только в окне +-window_in_degr около нормали; 0: во всех строках.
+     Нормаль - к прямой, приближающей методом наименьших квадратов точку и по normal_half_window соседних (по x)
+     точек с каждой стороны: на зашумлённых данных окно должно быть шире шума между соседними точками */
+    void SetHoughOrientedVoting(double window_in_degr, int normal_half_window = 16);
+    /* Уточнение прямой: максимум таблицы интерполируется внутри ячейки (если нет уточнения на мелкой сетке),
+     после выбора точек прямая пересчитывается по ним методом наименьших квадратов.
+     Позволяет использовать более грубую таблицу без потери точности прямой */
+    void SetRecogLineRefinement(bool is_enabled) { _is_recog_line_refined = is_enabled; }
+    /* Точки прямой - точки на расстоянии не больше band_width/2 от распознанной прямой, что устойчивее к шуму;
+     0: точки, голосующие за ячейку максимума */
+    void SetPickBandWidth(double band_width);
+    /* Несколько прямых за один проход по таблице: следующие peaks_cnt - 1 шагов берут очередной отделённый
+     максимум (см. HoughTransform::FindPeaks) без голосования и поиска максимума; 1: одна прямая за проход.
+     Максимумы, ослабевшие после удаления точек, пропускаются. При вероятностном голосовании не действует */
+    void SetHoughPeaksPerPass(int peaks_cnt, double min_angle_dist_in_degr = 10, double min_radius_dist = 1,
+                              double min_rel_votes = 0.5);
+
+    //Точность экспоненты в нормальных функциях принадлежности: при построении системы уравнений и в контроллере
+    void SetExpAccuracy(ExpAccuracy accuracy);
+    void SetSolverType(SolverType solver_type) { _solver_type = solver_type; }
+
     bool BuildNextMemFunc();
+    //Статистика последнего вызова BuildNextMemFunc: неудачные попытки распознать прямую и полные голосования
+    int GetStepRetriesCnt() const { return _step_retries_cnt; }
+    int GetStepVotingsCnt() const { return _step_votings_cnt; }
     void BuildCntl();
     void BuildAll();
 
 protected:
-    struct PointInfo
-    {
-        PointInfo(double x = 0, double y = 0, bool is_removed = false)
-            : x(x), y(y), is_removed(is_removed) { }
-        double x;
-        double y;
-        bool is_removed;
-    };
     QVector<DistCluster> KMeansByDist();
 
-    void AscSortPointsByX(QVector<PointInfo> &points);
+    void AscSortPointsByX();
+    void EstimateNormalAngles();
     void PrepareToLearning(double x_of_max_abs_y, double max_abs_y);
+    void CompactRestPoints();
     void RecogNextLine();
+    void VoteRestPoints();
     void PickPointsFromRecogLine();
 
     void FilterRecogLinePoints();
+    void RefitRecogLine();
     void BuildMemFunc();
 
     void MarkPointsFromRecogLineAsRemoved();
 
+    /* Строки [row_begin, row_end) матрицы системы. Матрица хранится по столбцам длины a_rows_cnt начиная с a_data,
+     её первая строка соответствует точке a_first_row */
+    void FillCntlSystemRows(int row_begin, int row_end, double *a_data, int a_rows_cnt, int a_first_row);
+    QVector<double> SolveCntlSystemDense();
+    QVector<double> SolveCntlSystemByBlocks();
+
 protected:
-    QVector<PointInfo> _input_points;
+    //Входные точки хранятся по столбцам (отсортированы по x), признак удаления - в отдельном массиве
+    QVector<double> _input_x, _input_y;
+    QVector<bool> _is_point_removed;
     int _not_removed_points_cnt = 0;
-    QVector<PointInfo*> _recog_line_points_ptrs;
+    //Номера точек распознанной прямой во входных массивах (по возрастанию)
+    QVector<int> _recog_line_points_ids;
+    /* Рабочий набор: плотные копии координат неудалённых точек, передаваемые в преобразование Хафа одним блоком.
+     Сжимается в начале шага; входные массивы не меняются (по ним строится и проверяется контроллер) */
+    QVector<double> _rest_points_x, _rest_points_y;
+    QVector<int> _rest_points_ids;
+    //Оценки нормали во входных точках (в том же порядке, что и _input_x); вычисляются только для направленного голосования
+    QVector<double> _normal_angles_in_degr, _rest_points_normals;
+    bool _is_voting_oriented = false;
+    int _normal_half_window = 16;
+    QVector<bool> _is_rest_point_from_line;
+    //Таблица Хафа содержит голоса всех неудалённых точек, удалённые точки из неё вычитаются
+    bool _is_hough_table_actual = false;
+    int _hough_refine_factor = 1;
+    bool _is_recog_line_refined = false;
+    double _pick_band_width = 0;
+    double _hough_sample_fraction = 1;
+    int _hough_peaks_per_pass = 1;
+    double _hough_peaks_min_angle_dist = 10, _hough_peaks_min_radius_dist = 1, _hough_peaks_min_rel_votes = 0.5;
+    //Максимумы последнего прохода по таблице, ещё не использованные для построения термов
+    QVector<HoughTransform::Peak> _pending_peaks;
+    bool _is_recog_line_from_queue = false;
     double _recog_line_angle_coef = 0, _recog_line_shift = 0;
     int _steps_done = 0;
     bool _is_ready_to_build = false;
 
     int _repeated_calls = 0;
     bool _have_to_use_filter = true;
+    int _step_retries_cnt = 0, _step_votings_cnt = 0;
 
-    QVector<UnaryFunc> _mem_funcs;
+    QVector<MemFuncParams> _mem_funcs;
+    ExpAccuracy _exp_accuracy = eaEXACT;
+    SolverType _solver_type = stDENSE;
 
     HoughTransform _hough;
     SugenoCntl _cntl;
+    //Строки системы уравнений в BuildCntl делятся между потоками
+    ThreadPool _thread_pool;
+    static const int _ROWS_BLOCK_SIZE = 1024;
 };
 
 #endif // CNTLBUILDER_H
@@ -0,0 +1,134 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "ExpKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EXP_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*CalcNormalValuesFunc)(const double*, int, double, double, double*);
+
+static const double EXP_MIN_ARG = -708, EXP_MAX_ARG = 708;
+static const double LOG2E = 1.4426950408889634;
+//ln2 = LN2_HI + LN2_LO, произведение k*LN2_HI точно для |k| < 2^11
+static const double LN2_HI = 6.93147180369123816490e-01, LN2_LO = 1.90821492927058770002e-10;
+//Сложение с 1.5*2^52 округляет до целого, которое оказывается в младших битах мантиссы суммы
+static const double ROUND_MAGIC = 6755399441055744.0;
+static const double INV_FACTORIALS[] = { 1.0, 1.0, 1.0/2, 1.0/6, 1.0/24, 1.0/120, 1.0/720, 1.0/5040 };
+
+static int64_t DoubleBits(double value)
+{
+    int64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+//Степень многочлена: остаток ряда при |r| <= ln2/2 меньше 1e-8 для DEGREE = 7 и 6e-5 для DEGREE = 4
+template <int DEGREE>
+static inline double ApproxExp(double x)
+{
+    //Нормальная функция принадлежности вдали от центра должна обнуляться, как с std::exp
+    if (x < EXP_MIN_ARG) return 0;
+    x = std::min(x, EXP_MAX_ARG);
+    double shifted = x*LOG2E + ROUND_MAGIC;
+    double k = shifted - ROUND_MAGIC;
+    double r = (x - k*LN2_HI) - k*LN2_LO;
+    double poly = INV_FACTORIALS[DEGREE];
+    for (int n = DEGREE - 1; 0 <= n; --n) {
+        poly = poly*r + INV_FACTORIALS[n];
+    }
+    //2^k собирается прямо в битах: смещённый порядок k + 1023
+    uint64_t pow2_bits = uint64_t(DoubleBits(shifted) - DoubleBits(ROUND_MAGIC) + 1023) << 52;
+    double pow2;
+    std::memcpy(&pow2, &pow2_bits, sizeof(pow2));
+    return poly * pow2;
+}
+
+double CalcExp(double x, ExpAccuracy accuracy)
+{
+    switch (accuracy) {
+    case eaREL_1E_7: return ApproxExp<7>(x);
+    case eaREL_1E_4: return ApproxExp<4>(x);
+    default: return std::exp(x);
+    }
+}
+
+template <int DEGREE>
+static void CalcNormalValuesScalar(const double *xs, int points_cnt, double center, double scale, double *values)
+{
+    for (int i = 0; i < points_cnt; ++i) {
+        double dist = xs[i] - center;
+        values[i] = ApproxExp<DEGREE>(-scale * dist*dist);
+    }
+}
+
+#ifdef EXP_KERNELS_X86
+
+template <int DEGREE>
+__attribute__((target("avx2")))
+static void CalcNormalValuesAvx2(const double *xs, int points_cnt, double center, double scale, double *values)
+{
+    const __m256d center_v = _mm256_set1_pd(center), neg_scale_v = _mm256_set1_pd(-scale),
+                  min_v = _mm256_set1_pd(EXP_MIN_ARG), max_v = _mm256_set1_pd(EXP_MAX_ARG),
+                  log2e_v = _mm256_set1_pd(LOG2E), magic_v = _mm256_set1_pd(ROUND_MAGIC),
+                  ln2_hi_v = _mm256_set1_pd(LN2_HI), ln2_lo_v = _mm256_set1_pd(LN2_LO);
+    const __m256i exp_bias_v = _mm256_set1_epi64x(1023 - DoubleBits(ROUND_MAGIC));
+    int i = 0;
+    for (; i + 4 <= points_cnt; i += 4) {
+        //Те же операции в том же порядке (без FMA), что и в скалярной версии
+        __m256d dist = _mm256_sub_pd(_mm256_loadu_pd(xs + i), center_v);
+        __m256d x = _mm256_mul_pd(_mm256_mul_pd(neg_scale_v, dist), dist);
+        __m256d is_underflow = _mm256_cmp_pd(x, min_v, _CMP_LT_OQ);
+        x = _mm256_min_pd(_mm256_max_pd(x, min_v), max_v);
+        __m256d shifted = _mm256_add_pd(_mm256_mul_pd(x, log2e_v), magic_v);
+        __m256d k = _mm256_sub_pd(shifted, magic_v);
+        __m256d r = _mm256_sub_pd(_mm256_sub_pd(x, _mm256_mul_pd(k, ln2_hi_v)), _mm256_mul_pd(k, ln2_lo_v));
+        __m256d poly = _mm256_set1_pd(INV_FACTORIALS[DEGREE]);
+        for (int n = DEGREE - 1; 0 <= n; --n) {
+            poly = _mm256_add_pd(_mm256_mul_pd(poly, r), _mm256_set1_pd(INV_FACTORIALS[n]));
+        }
+        __m256i pow2_bits = _mm256_slli_epi64(_mm256_add_epi64(_mm256_castpd_si256(shifted), exp_bias_v), 52);
+        __m256d exp_vals = _mm256_mul_pd(poly, _mm256_castsi256_pd(pow2_bits));
+        _mm256_storeu_pd(values + i, _mm256_andnot_pd(is_underflow, exp_vals));
+    }
+    CalcNormalValuesScalar<DEGREE>(xs + i, points_cnt - i, center, scale, values + i);
+}
+
+template <int DEGREE>
+static CalcNormalValuesFunc SelectCalcNormalValues()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return CalcNormalValuesAvx2<DEGREE>;
+    return CalcNormalValuesScalar<DEGREE>;
+}
+
+#else
+
+template <int DEGREE>
+static CalcNormalValuesFunc SelectCalcNormalValues()
+{
+    return CalcNormalValuesScalar<DEGREE>;
+}
+
+#endif // EXP_KERNELS_X86
+
+void CalcNormalValues(const double *xs, int points_cnt, double center, double scale, ExpAccuracy accuracy,
+                      double *values)
+{
+    static const CalcNormalValuesFunc calc_1e7_func = SelectCalcNormalValues<7>();
+    static const CalcNormalValuesFunc calc_1e4_func = SelectCalcNormalValues<4>();
+    switch (accuracy) {
+    case eaREL_1E_7: calc_1e7_func(xs, points_cnt, center, scale, values); break;
+    case eaREL_1E_4: calc_1e4_func(xs, points_cnt, center, scale, values); break;
+    default:
+        for (int i = 0; i < points_cnt; ++i) {
+            double dist = xs[i] - center;
+            values[i] = std::exp(-scale * dist*dist);
+        }
+        break;
+    }
+}
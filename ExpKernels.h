@@ -0,0 +1,16 @@
+#ifndef EXPKERNELS_H
+#define EXPKERNELS_H
+
+/* Точность экспоненты в нормальных функциях принадлежности: точная (std::exp) или приближённая
+ с относительной ошибкой не больше 1e-7 либо 1e-4 (редукция аргумента к |r| <= ln2/2 и многочлен Тейлора) */
+enum ExpAccuracy { eaEXACT, eaREL_1E_7, eaREL_1E_4 };
+
+//exp(x): для x < -708 - ноль, x > 708 ограничивается значением 708
+double CalcExp(double x, ExpAccuracy accuracy);
+
+/* values[i] = exp(-scale * (xs[i] - center)^2) - значения нормальной функции принадлежности для группы точек.
+ Реализация приближённых вариантов (AVX2 или скалярная) выбирается при первом вызове по возможностям процессора */
+void CalcNormalValues(const double *xs, int points_cnt, double center, double scale, ExpAccuracy accuracy,
+                      double *values);
+
+#endif // EXPKERNELS_H
@@ -20,18 +20,26 @@ SOURCES += \
     Main.cpp \
     UnaryFunc.cpp \
     HoughTransform.cpp \
+    HoughKernels.cpp \
+    ExpKernels.cpp \
     SugenoCntl.cpp \
+    BakedCntl.cpp \
     MainWindow.cpp \
-    CntlBuilder.cpp
+    CntlBuilder.cpp \
+    ThreadPool.cpp
 
 HEADERS  += \
     qcustomplot.h \
     UnaryFunc.h \
     UnaryFuncBase.h \
     HoughTransform.h \
+    HoughKernels.h \
+    ExpKernels.h \
     SugenoCntl.h \
+    BakedCntl.h \
     MainWindow.h \
-    CntlBuilder.h
+    CntlBuilder.h \
+    ThreadPool.h
 
 DISTFILES += \
     Outlines \
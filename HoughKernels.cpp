@@ -0,0 +1,187 @@
+#include <QtGlobal>
+
+#include "HoughKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HOUGH_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*CalcRadiusColsFunc)(const double*, const double*, int, double, double, double, double, double, int*);
+
+void CalcRadiusColsScalar(const double *x, const double *y, int points_cnt,
+                          double cos_val, double sin_val, double min_radius, double max_radius, double radius_step, int *cols)
+{
+    for (int i = 0; i < points_cnt; ++i) {
+        double radius = x[i]*cos_val + y[i]*sin_val;
+        //Для неотрицательного аргумента совпадает с qRound
+        cols[i] = (min_radius <= radius && radius <= max_radius)? int((radius - min_radius) / radius_step + 0.5): -1;
+    }
+}
+
+#ifdef HOUGH_KERNELS_X86
+
+static void CalcRadiusColsSse2(const double *x, const double *y, int points_cnt,
+                               double cos_val, double sin_val, double min_radius, double max_radius, double radius_step, int *cols)
+{
+    const __m128d cos_v = _mm_set1_pd(cos_val), sin_v = _mm_set1_pd(sin_val),
+                  min_v = _mm_set1_pd(min_radius), max_v = _mm_set1_pd(max_radius),
+                  step_v = _mm_set1_pd(radius_step), half_v = _mm_set1_pd(0.5);
+    const __m128i invalid_v = _mm_set1_epi32(-1);
+    int i = 0;
+    for (; i + 2 <= points_cnt; i += 2) {
+        __m128d radius = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x + i), cos_v),
+                                    _mm_mul_pd(_mm_loadu_pd(y + i), sin_v));
+        __m128d in_range = _mm_and_pd(_mm_cmpge_pd(radius, min_v), _mm_cmple_pd(radius, max_v));
+        __m128i col = _mm_cvttpd_epi32(_mm_add_pd(_mm_div_pd(_mm_sub_pd(radius, min_v), step_v), half_v));
+        //Маска из двух 64-битных элементов сжимается до двух 32-битных
+        __m128i mask = _mm_shuffle_epi32(_mm_castpd_si128(in_range), _MM_SHUFFLE(3, 3, 2, 0));
+        col = _mm_or_si128(_mm_and_si128(mask, col), _mm_andnot_si128(mask, invalid_v));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(cols + i), col);
+    }
+    CalcRadiusColsScalar(x + i, y + i, points_cnt - i, cos_val, sin_val, min_radius, max_radius, radius_step, cols + i);
+}
+
+__attribute__((target("avx2")))
+static void CalcRadiusColsAvx2(const double *x, const double *y, int points_cnt,
+                               double cos_val, double sin_val, double min_radius, double max_radius, double radius_step, int *cols)
+{
+    const __m256d cos_v = _mm256_set1_pd(cos_val), sin_v = _mm256_set1_pd(sin_val),
+                  min_v = _mm256_set1_pd(min_radius), max_v = _mm256_set1_pd(max_radius),
+                  step_v = _mm256_set1_pd(radius_step), half_v = _mm256_set1_pd(0.5);
+    const __m128i invalid_v = _mm_set1_epi32(-1);
+    int i = 0;
+    for (; i + 4 <= points_cnt; i += 4) {
+        //Умножение и сложение раздельные (без FMA), чтобы результат совпадал со скалярной версией
+        __m256d radius = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), cos_v),
+                                       _mm256_mul_pd(_mm256_loadu_pd(y + i), sin_v));
+        __m256d in_range = _mm256_and_pd(_mm256_cmp_pd(radius, min_v, _CMP_GE_OQ),
+                                         _mm256_cmp_pd(radius, max_v, _CMP_LE_OQ));
+        __m128i col = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_div_pd(_mm256_sub_pd(radius, min_v), step_v), half_v));
+        __m128i mask = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                           _mm256_castpd_si256(in_range), _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+        col = _mm_blendv_epi8(invalid_v, col, mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cols + i), col);
+    }
+    CalcRadiusColsScalar(x + i, y + i, points_cnt - i, cos_val, sin_val, min_radius, max_radius, radius_step, cols + i);
+}
+
+static CalcRadiusColsFunc SelectCalcRadiusCols()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return CalcRadiusColsAvx2;
+    if (__builtin_cpu_supports("sse2")) return CalcRadiusColsSse2;
+    return CalcRadiusColsScalar;
+}
+
+#else
+
+static CalcRadiusColsFunc SelectCalcRadiusCols()
+{
+    return CalcRadiusColsScalar;
+}
+
+#endif // HOUGH_KERNELS_X86
+
+void CalcRadiusCols(const double *x, const double *y, int points_cnt,
+                    double cos_val, double sin_val, double min_radius, double max_radius, double radius_step, int *cols)
+{
+    static const CalcRadiusColsFunc calc_func = SelectCalcRadiusCols();
+    calc_func(x, y, points_cnt, cos_val, sin_val, min_radius, max_radius, radius_step, cols);
+}
+
+template <typename Cell>
+static int FindFirstCellEqualTo(const Cell *cells, int cells_cnt, Cell value)
+{
+    for (int col = 0; col < cells_cnt; ++col) {
+        if (cells[col] == value) return col;
+    }
+    return 0;
+}
+
+template <typename Cell>
+static int FindMaxInRowScalar(const Cell *cells, int cells_cnt)
+{
+    int col_of_max = 0;
+    for (int col = 1; col < cells_cnt; ++col) {
+        if (cells[col_of_max] < cells[col]) col_of_max = col;
+    }
+    return col_of_max;
+}
+
+#ifdef HOUGH_KERNELS_X86
+
+/* Сначала векторно находится максимальное значение, затем первая ячейка с этим значением.
+ SSE2 есть на любом x86-64, поэтому выбор реализации во время выполнения не нужен */
+int FindMaxInRow(const double *cells, int cells_cnt)
+{
+    if (cells_cnt < 4) return FindMaxInRowScalar(cells, cells_cnt);
+    __m128d max_v = _mm_loadu_pd(cells);
+    int col = 2;
+    for (; col + 2 <= cells_cnt; col += 2) {
+        max_v = _mm_max_pd(max_v, _mm_loadu_pd(cells + col));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, max_v);
+    double max_val = qMax(lanes[0], lanes[1]);
+    for (; col < cells_cnt; ++col) {
+        max_val = qMax(max_val, cells[col]);
+    }
+    return FindFirstCellEqualTo(cells, cells_cnt, max_val);
+}
+
+int FindMaxInRow(const float *cells, int cells_cnt)
+{
+    if (cells_cnt < 8) return FindMaxInRowScalar(cells, cells_cnt);
+    __m128 max_v = _mm_loadu_ps(cells);
+    int col = 4;
+    for (; col + 4 <= cells_cnt; col += 4) {
+        max_v = _mm_max_ps(max_v, _mm_loadu_ps(cells + col));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, max_v);
+    float max_val = qMax(qMax(lanes[0], lanes[1]), qMax(lanes[2], lanes[3]));
+    for (; col < cells_cnt; ++col) {
+        max_val = qMax(max_val, cells[col]);
+    }
+    return FindFirstCellEqualTo(cells, cells_cnt, max_val);
+}
+
+int FindMaxInRow(const int32_t *cells, int cells_cnt)
+{
+    if (cells_cnt < 8) return FindMaxInRowScalar(cells, cells_cnt);
+    __m128i max_v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells));
+    int col = 4;
+    for (; col + 4 <= cells_cnt; col += 4) {
+        __m128i vals = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + col));
+        //В SSE2 нет pmaxsd, максимум выбирается по маске сравнения
+        __m128i is_greater = _mm_cmpgt_epi32(vals, max_v);
+        max_v = _mm_or_si128(_mm_and_si128(is_greater, vals), _mm_andnot_si128(is_greater, max_v));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), max_v);
+    int32_t max_val = qMax(qMax(lanes[0], lanes[1]), qMax(lanes[2], lanes[3]));
+    for (; col < cells_cnt; ++col) {
+        max_val = qMax(max_val, cells[col]);
+    }
+    return FindFirstCellEqualTo(cells, cells_cnt, max_val);
+}
+
+#else
+
+int FindMaxInRow(const double *cells, int cells_cnt)
+{
+    return FindMaxInRowScalar(cells, cells_cnt);
+}
+
+int FindMaxInRow(const float *cells, int cells_cnt)
+{
+    return FindMaxInRowScalar(cells, cells_cnt);
+}
+
+int FindMaxInRow(const int32_t *cells, int cells_cnt)
+{
+    return FindMaxInRowScalar(cells, cells_cnt);
+}
+
+#endif // HOUGH_KERNELS_X86
@@ -0,0 +1,22 @@
+#ifndef HOUGHKERNELS_H
+#define HOUGHKERNELS_H
+
+#include <cstdint>
+
+/* Вычисление номеров столбцов таблицы Хафа для группы точек при фиксированном угле:
+ radius = x*cos_val + y*sin_val, col = qRound((radius - min_radius) / radius_step).
+ Для точек, у которых radius вне [min_radius, max_radius], записывается -1.
+ Реализация (AVX2, SSE2 или скалярная) выбирается при первом вызове по возможностям процессора */
+void CalcRadiusCols(const double *x, const double *y, int points_cnt,
+                    double cos_val, double sin_val, double min_radius, double max_radius, double radius_step,
+                    int *cols);
+
+void CalcRadiusColsScalar(const double *x, const double *y, int points_cnt,
+                          double cos_val, double sin_val, double min_radius, double max_radius, double radius_step, int *cols);
+
+//Номер первой ячейки с максимальным значением в строке таблицы (cells_cnt > 0)
+int FindMaxInRow(const double *cells, int cells_cnt);
+int FindMaxInRow(const float *cells, int cells_cnt);
+int FindMaxInRow(const int32_t *cells, int cells_cnt);
+
+#endif // HOUGHKERNELS_H
@@ -1,8 +1,17 @@
 #include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#include <algorithm>
 
 #include <QtMath>
+#include "HoughKernels.h"
 #include "HoughTransform.h"
 
+//Определения нужны: константы передаются в qMin/qMax по ссылке
+const int HoughTransform::_POINTS_BLOCK_SIZE;
+const int HoughTransform::_MIN_RANDOM_PORTION;
+
 HoughTransform::HoughTransform(double arg_of_max_mod, double value_of_max_mod, double radius_step)
 {
     Init(arg_of_max_mod, value_of_max_mod, radius_step);
@@ -17,32 +26,226 @@ void HoughTransform::Init(double arg_of_max_abs, double value_of_max_abs, double
 {
     double arg_sqr = arg_of_max_abs * arg_of_max_abs;
     double value_sqr = value_of_max_abs * value_of_max_abs;
-    radius_step = qMax(_MIN_RADIUS_STEP, qMin(radius_step, _MAX_RADIUS_STEP));
-
-    this->_radius_step = radius_step;
     _max_radius = qCeil(qSqrt(arg_sqr + value_sqr));
+    _radius_step = radius_step;
+
+    InitTable();
+}
+
+void HoughTransform::SetAngleRange(double min_angle_in_degr, double max_angle_in_degr, int angles_cnt)
+{
+    assert(min_angle_in_degr < max_angle_in_degr && max_angle_in_degr - min_angle_in_degr <= 360);
+    assert(0 < angles_cnt);
+    _min_angle_in_degr = min_angle_in_degr;
+    _max_angle_in_degr = max_angle_in_degr;
+    _rows_as_angle_values = angles_cnt;
+    //Содержимое таблицы теряется
+    if (_columns_as_radius_values != 0) InitTable();
+}
+
+void HoughTransform::SetRadiusStepRange(double min_radius_step, double max_radius_step)
+{
+    assert(0 < min_radius_step && min_radius_step <= max_radius_step);
+    _min_radius_step = min_radius_step;
+    _max_radius_step = max_radius_step;
+    if (_columns_as_radius_values != 0) InitTable();
+}
+
+void HoughTransform::SetRadiusStep(double radius_step)
+{
+    _radius_step = radius_step;
+    if (_columns_as_radius_values != 0) InitTable();
+}
+
+void HoughTransform::InitTable()
+{
+    _radius_step = qMax(_min_radius_step, qMin(_radius_step, _max_radius_step));
+    /* Если углы покрывают всю окружность, любую прямую можно задать неотрицательным радиусом.
+     Иначе (например, углы 0-180) радиус может быть отрицательным */
+    _min_radius = IsFullCircle()? 0: -_max_radius;
     //Один столбец для нуля
-    _columns_as_radius_values = qRound(_max_radius / radius_step) + 1;
+    _columns_as_radius_values = qRound((_max_radius - _min_radius) / _radius_step) + 1;
 
+    InitTrigTables();
     CreateTable();
     Clear();
 }
 
+double HoughTransform::RowAngleInDegr(int row) const
+{
+    return _min_angle_in_degr + row * (_max_angle_in_degr - _min_angle_in_degr) / _rows_as_angle_values;
+}
+
+void HoughTransform::SetCellType(CellType cell_type)
+{
+    if (_cell_type == cell_type) return;
+    _cell_type = cell_type;
+    if (_columns_as_radius_values != 0) {
+        //Размер ячейки изменился, содержимое таблицы теряется
+        CreateTable();
+        Clear();
+    }
+}
+
 void HoughTransform::AddPoint(double x, double y, double weight)
 {
-    assert(_matrix != nullptr);
-    for (int angle_in_degr = 0; angle_in_degr < _ROWS_AS_ANGLE_VALUES; angle_in_degr++) {
-        double angle_in_rad = qDegreesToRadians(double(angle_in_degr));
-        double radius = x*qCos(angle_in_rad) + y*qSin(angle_in_rad);
-        if (0 <= radius && radius <= _max_radius) {
-            int row = angle_in_degr;
-            int col = qRound(radius / _radius_step);
-            _matrix[row][col] += weight;
+    AddPoints(&x, &y, &weight, 1);
+}
+
+void HoughTransform::AddPoints(const double *x, const double *y, const double *weights, int points_cnt,
+                               const double *normal_angles_in_degr)
+{
+    VotePoints(x, y, weights, normal_angles_in_degr, points_cnt, 1);
+}
+
+void HoughTransform::RemovePoint(double x, double y, double weight)
+{
+    RemovePoints(&x, &y, &weight, 1);
+}
+
+void HoughTransform::RemovePoints(const double *x, const double *y, const double *weights, int points_cnt,
+                                  const double *normal_angles_in_degr)
+{
+    //Голоса вычитаются из тех же ячеек, в которые были добавлены
+    VotePoints(x, y, weights, normal_angles_in_degr, points_cnt, -1);
+}
+
+void HoughTransform::SetOrientedVoting(double window_in_degr)
+{
+    //Окна около нормали и противоположного ей направления не должны пересекаться
+    assert(0 <= window_in_degr && window_in_degr < 90);
+    _oriented_window_in_degr = window_in_degr;
+}
+
+void HoughTransform::VotePoints(const double *x, const double *y, const double *weights, const double *normal_angles_in_degr,
+                                int points_cnt, double weight_sign)
+{
+    assert(_cells != nullptr);
+    //Пока веса неотрицательны, значения ячеек только растут и максимум можно отслеживать во время голосования
+    bool has_negative_weights = (weight_sign < 0);
+    if (weights != nullptr) {
+        for (int i = 0; i < points_cnt; ++i) {
+            has_negative_weights |= (weight_sign*weights[i] < 0);
+        }
+    }
+    bool is_max_tracked = _is_max_tracked && has_negative_weights == false;
+    if (normal_angles_in_degr != nullptr && 0 < _oriented_window_in_degr) {
+        switch (_cell_type) {
+        case ctDOUBLE:
+            AddOrientedPointsToTable<double>(x, y, weights, normal_angles_in_degr, points_cnt, weight_sign, is_max_tracked);
+            break;
+        case ctFLOAT:
+            AddOrientedPointsToTable<float>(x, y, weights, normal_angles_in_degr, points_cnt, weight_sign, is_max_tracked);
+            break;
+        case ctINT32:
+            AddOrientedPointsToTable<int32_t>(x, y, weights, normal_angles_in_degr, points_cnt, weight_sign, is_max_tracked);
+            break;
+        }
+    } else {
+        switch (_cell_type) {
+        case ctDOUBLE: AddPointsToTable<double>(x, y, weights, points_cnt, weight_sign, is_max_tracked); break;
+        case ctFLOAT: AddPointsToTable<float>(x, y, weights, points_cnt, weight_sign, is_max_tracked); break;
+        case ctINT32: AddPointsToTable<int32_t>(x, y, weights, points_cnt, weight_sign, is_max_tracked); break;
         }
     }
+    _is_max_tracked = is_max_tracked;
     _is_result_found = false;
 }
 
+template <typename Cell>
+void HoughTransform::AddPointsToTable(const double *x, const double *y, const double *weights, int points_cnt,
+                                      double weight_sign, bool is_max_tracked)
+{
+    //Каждый поток владеет своими строками таблицы, поэтому синхронизация и слияние таблиц не нужны
+    std::mutex max_mutex;
+    auto vote_in_rows = [&](int row_begin, int row_end) {
+        MaxCell rows_max = VoteInRows<Cell>(row_begin, row_end, x, y, weights, points_cnt,
+                                             weight_sign, is_max_tracked);
+        std::lock_guard<std::mutex> lock(max_mutex);
+        if (rows_max.IsBetterThan(_max_cell)) _max_cell = rows_max;
+    };
+    if (qint64(points_cnt) * _rows_as_angle_values < _MIN_VOTES_FOR_PARALLEL) {
+        vote_in_rows(0, _rows_as_angle_values);
+    } else {
+        _thread_pool.ParallelFor(0, _rows_as_angle_values, vote_in_rows);
+    }
+}
+
+template <typename Cell>
+HoughTransform::MaxCell HoughTransform::VoteInRows(int row_begin, int row_end,
+                                                   const double *x, const double *y, const double *weights, int points_cnt,
+                                                   double weight_sign, bool is_max_tracked)
+{
+    MaxCell rows_max;
+    int cols[_POINTS_BLOCK_SIZE];
+    for (int block_start = 0; block_start < points_cnt; block_start += _POINTS_BLOCK_SIZE) {
+        int block_size = qMin(_POINTS_BLOCK_SIZE, points_cnt - block_start);
+        const double *block_x = x + block_start, *block_y = y + block_start;
+        const double *block_weights = (weights != nullptr)? weights + block_start: nullptr;
+        for (int row = row_begin; row < row_end; ++row) {
+            CalcRadiusCols(block_x, block_y, block_size, _cos_vals[row], _sin_vals[row],
+                           _min_radius, _max_radius, _radius_step, cols);
+            Cell *cells = Row<Cell>(row);
+            for (int i = 0; i < block_size; ++i) {
+                int col = cols[i];
+                if (col < 0) continue;
+                //Для целочисленных ячеек вес округляется
+                double weight = (block_weights == nullptr)? weight_sign: weight_sign*block_weights[i];
+                Cell cell_weight = (_cell_type == ctINT32)? Cell(qRound(weight)): Cell(weight);
+                cells[col] += cell_weight;
+                if (is_max_tracked == true) {
+                    MaxCell cell(cells[col], row, col);
+                    if (cell.IsBetterThan(rows_max)) rows_max = cell;
+                }
+            }
+        }
+    }
+    return rows_max;
+}
+
+template <typename Cell>
+void HoughTransform::AddOrientedPointsToTable(const double *x, const double *y, const double *weights,
+                                              const double *normal_angles_in_degr, int points_cnt,
+                                              double weight_sign, bool is_max_tracked)
+{
+    //Каждая точка голосует только в строках, близких к её нормали; голосов в десятки раз меньше, потоки не нужны
+    const double angle_step = (_max_angle_in_degr - _min_angle_in_degr) / _rows_as_angle_values;
+    MaxCell points_max;
+    for (int i = 0; i < points_cnt; ++i) {
+        double weight = (weights == nullptr)? weight_sign: weight_sign*weights[i];
+        Cell cell_weight = (_cell_type == ctINT32)? Cell(qRound(weight)): Cell(weight);
+        auto vote_in_rows = [&](int row_begin, int row_end) {
+            for (int row = row_begin; row < row_end; ++row) {
+                double radius = x[i]*_cos_vals[row] + y[i]*_sin_vals[row];
+                if (radius < _min_radius || _max_radius < radius) continue;
+                int col = qRound((radius - _min_radius) / _radius_step);
+                Cell *cells = Row<Cell>(row);
+                cells[col] += cell_weight;
+                if (is_max_tracked == true) {
+                    MaxCell cell(cells[col], row, col);
+                    if (cell.IsBetterThan(points_max)) points_max = cell;
+                }
+            }
+        };
+
+        double normal_angle = normal_angles_in_degr[i];
+        if (qIsNaN(normal_angle)) {
+            //Нормаль не определена, точка голосует во всех строках
+            vote_in_rows(0, _rows_as_angle_values);
+            continue;
+        }
+        //Прямая задаётся нормалью с точностью до 180 градусов, диапазон углов может быть сдвинут на 360
+        for (int shift = -2; shift <= 2; ++shift) {
+            double center = normal_angle + 180*shift;
+            int row_begin = qMax(0, qCeil((center - _oriented_window_in_degr - _min_angle_in_degr) / angle_step));
+            int row_end = qMin(_rows_as_angle_values,
+                               qFloor((center + _oriented_window_in_degr - _min_angle_in_degr) / angle_step) + 1);
+            vote_in_rows(row_begin, row_end);
+        }
+    }
+    if (points_max.IsBetterThan(_max_cell)) _max_cell = points_max;
+}
+
 double HoughTransform::GetNormalAngleInDegr()
 {
     if (_is_result_found == false) FindResult();
@@ -59,20 +262,51 @@ bool HoughTransform::IsPointFromRecogLine(double x, double y)
 {
     if (_is_result_found == false) FindResult();
 
-    for (int angle_in_degr = 0; angle_in_degr < _ROWS_AS_ANGLE_VALUES; angle_in_degr++) {
-        double angle_in_rad = qDegreesToRadians(double(angle_in_degr));
-        double radius = x*qCos(angle_in_rad) + y*qSin(angle_in_rad);
-        if (0 <= radius && radius <= _max_radius) {
-            int row = angle_in_degr;
-            int col = qRound(radius / _radius_step);
-            if (row == _row_of_max && col == _col_of_max) {
-                return true;
-           }
-        }
+    //Точка лежит на распознанной прямой, если при угле максимума она голосует за ячейку максимума
+    const LineCell &cell = _line_cell;
+    double radius = x*cell.cos_val + y*cell.sin_val;
+    if (cell.min_radius <= radius && radius <= cell.max_radius) {
+        return qRound((radius - cell.min_radius) / cell.radius_step) == cell.col;
     }
     return false;
 }
 
+void HoughTransform::FindPointsFromRecogLine(const double *x, const double *y, int points_cnt, bool *is_from_line)
+{
+    if (_is_result_found == false) FindResult();
+
+    int cols[_POINTS_BLOCK_SIZE];
+    for (int block_start = 0; block_start < points_cnt; block_start += _POINTS_BLOCK_SIZE) {
+        int block_size = qMin(_POINTS_BLOCK_SIZE, points_cnt - block_start);
+        CalcRadiusCols(x + block_start, y + block_start, block_size, _line_cell.cos_val, _line_cell.sin_val,
+                       _line_cell.min_radius, _line_cell.max_radius, _line_cell.radius_step, cols);
+        for (int i = 0; i < block_size; ++i) {
+            is_from_line[block_start + i] = (cols[i] == _line_cell.col);
+        }
+    }
+}
+
+void HoughTransform::FindPointsNearRecogLine(const double *x, const double *y, int points_cnt, double max_dist,
+                                             bool *is_from_line)
+{
+    assert(0 < max_dist);
+    if (_is_result_found == false) FindResult();
+
+    /* Расстояние до прямой - модуль разности радиусов точки и прямой, поэтому подходит тот же векторный расчёт:
+     при сетке [line_radius - max_dist, line_radius + max_dist] номер -1 получают только точки вне полосы */
+    const LineCell &cell = _line_cell;
+    const double line_radius = cell.min_radius + cell.col * cell.radius_step;
+    int cols[_POINTS_BLOCK_SIZE];
+    for (int block_start = 0; block_start < points_cnt; block_start += _POINTS_BLOCK_SIZE) {
+        int block_size = qMin(_POINTS_BLOCK_SIZE, points_cnt - block_start);
+        CalcRadiusCols(x + block_start, y + block_start, block_size, cell.cos_val, cell.sin_val,
+                       line_radius - max_dist, line_radius + max_dist, 2*max_dist, cols);
+        for (int i = 0; i < block_size; ++i) {
+            is_from_line[block_start + i] = (0 <= cols[i]);
+        }
+    }
+}
+
 double HoughTransform::GetLineAngleCoef()
 {
     if (_is_result_found == false) FindResult();
@@ -91,43 +325,364 @@ double HoughTransform::GetLineShift()
     return line_shift;
 }
 
-void HoughTransform::CreateTable()
+void HoughTransform::InitTrigTables()
 {
-    _matrix = new double*[_ROWS_AS_ANGLE_VALUES];
-    for (int i = 0; i < _ROWS_AS_ANGLE_VALUES; ++i) {
-       _matrix[i] = new double[_columns_as_radius_values];
+    //Тригонометрические функции вычисляются один раз, а не для каждой точки
+    _cos_vals.resize(_rows_as_angle_values);
+    _sin_vals.resize(_rows_as_angle_values);
+    for (int row = 0; row < _rows_as_angle_values; ++row) {
+        double angle_in_rad = qDegreesToRadians(RowAngleInDegr(row));
+        _cos_vals[row] = qCos(angle_in_rad);
+        _sin_vals[row] = qSin(angle_in_rad);
     }
 }
 
+int HoughTransform::CellSize() const
+{
+    switch (_cell_type) {
+    case ctFLOAT: return sizeof(float);
+    case ctINT32: return sizeof(int32_t);
+    default: return sizeof(double);
+    }
+}
+
+template <typename Cell>
+Cell* HoughTransform::Row(int row) const
+{
+    return static_cast<Cell*>(_cells) + size_t(row) * _row_stride;
+}
+
+double HoughTransform::CellValue(int row, int col) const
+{
+    switch (_cell_type) {
+    case ctFLOAT: return Row<float>(row)[col];
+    case ctINT32: return Row<int32_t>(row)[col];
+    default: return Row<double>(row)[col];
+    }
+}
+
+void HoughTransform::CreateTable()
+{
+    //Длина строки кратна выравниванию, чтобы каждая строка начиналась с границы кэш-линии
+    const int cells_in_alignment = _CELLS_ALIGNMENT / CellSize();
+    _row_stride = (_columns_as_radius_values + cells_in_alignment - 1) / cells_in_alignment * cells_in_alignment;
+    size_t bytes_cnt = size_t(_rows_as_angle_values) * _row_stride * CellSize();
+    //Буфер переиспользуется при повторных вызовах Init, если его размера достаточно
+    if (bytes_cnt <= _cells_capacity_in_bytes) return;
+
+    DeleteTable();
+    _cells = qMallocAligned(bytes_cnt, _CELLS_ALIGNMENT);
+    assert(_cells != nullptr);
+    _cells_capacity_in_bytes = bytes_cnt;
+}
+
 void HoughTransform::Clear()
 {
-    for (int row = 0; row < _ROWS_AS_ANGLE_VALUES; ++row) {
-        for (int col = 0; col < _columns_as_radius_values; ++col) {
-            _matrix[row][col] = 0;
+    //Нулевые байты соответствуют нулю для всех типов ячеек
+    std::memset(_cells, 0, size_t(_rows_as_angle_values) * _row_stride * CellSize());
+    //В пустой таблице результат поиска максимума - первая ячейка
+    _max_cell = MaxCell(0, 0, 0);
+    _is_max_tracked = true;
+    _is_result_found = false;
+}
+
+void HoughTransform::DeleteTable()
+{
+    qFreeAligned(_cells);
+    _cells = nullptr;
+    _cells_capacity_in_bytes = 0;
+}
+
+void HoughTransform::FindResult()
+{
+    if (_is_max_tracked == false) {
+        _max_cell = FindMaxCell();
+        _is_max_tracked = true;
+    }
+    SetResult(_max_cell.row, _max_cell.col);
+}
+
+void HoughTransform::SetResult(int row, int col)
+{
+    _row_of_max = row;
+    _col_of_max = col;
+    _res_angle_in_degr = RowAngleInDegr(_row_of_max); _res_radius = _min_radius + _col_of_max * _radius_step;
+    _line_cell = LineCell(_cos_vals[_row_of_max], _sin_vals[_row_of_max], _min_radius, _max_radius, _radius_step, _col_of_max);
+    _is_result_found = true;
+}
+
+void HoughTransform::SelectPeak(const Peak &peak)
+{
+    assert(0 <= peak.row && peak.row < _rows_as_angle_values);
+    assert(0 <= peak.col && peak.col < _columns_as_radius_values);
+    SetResult(peak.row, peak.col);
+}
+
+bool HoughTransform::IsPeakLive(const Peak &peak, double min_rel_votes)
+{
+    assert(0 <= peak.row && peak.row < _rows_as_angle_values);
+    assert(0 <= peak.col && peak.col < _columns_as_radius_values);
+    if (_is_max_tracked == false) {
+        _max_cell = FindMaxCell();
+        _is_max_tracked = true;
+    }
+    double votes = CellValue(peak.row, peak.col);
+    return 0 < votes && min_rel_votes * _max_cell.value <= votes;
+}
+
+void HoughTransform::FindPeaks(int max_peaks_cnt, double min_angle_dist_in_degr, double min_radius_dist,
+                               double min_rel_votes, QVector<Peak> &peaks)
+{
+    peaks.clear();
+    if (_is_max_tracked == false) {
+        _max_cell = FindMaxCell();
+        _is_max_tracked = true;
+    }
+    if (max_peaks_cnt <= 0 || _max_cell.value <= 0) return;
+
+    //Порог отсекает почти все ячейки до проверки соседей; пустые ячейки максимумами не считаются
+    double min_votes = qMax(min_rel_votes * _max_cell.value, std::numeric_limits<double>::min());
+    QVector<MaxCell> local_maxes;
+    switch (_cell_type) {
+    case ctFLOAT: FindLocalMaxInTable<float>(min_votes, local_maxes); break;
+    case ctINT32: FindLocalMaxInTable<int32_t>(min_votes, local_maxes); break;
+    default: FindLocalMaxInTable<double>(min_votes, local_maxes); break;
+    }
+    std::sort(local_maxes.begin(), local_maxes.end(),
+              [](const MaxCell &c1, const MaxCell &c2)->bool { return c1.IsBetterThan(c2); });
+
+    //Жадное подавление немаксимумов: более слабый максимум рядом с выбранным - часть той же прямой
+    const double angle_step = (_max_angle_in_degr - _min_angle_in_degr) / _rows_as_angle_values;
+    const int min_rows_dist = qCeil(min_angle_dist_in_degr / angle_step), min_cols_dist = qCeil(min_radius_dist / _radius_step);
+    for (const MaxCell &cell: local_maxes) {
+        if (max_peaks_cnt <= peaks.size()) break;
+        bool is_separated = true;
+        for (const Peak &peak: peaks) {
+            int rows_dist = qAbs(cell.row - peak.row);
+            //Для полной окружности первая и последняя строки соседние
+            if (IsFullCircle()) rows_dist = qMin(rows_dist, _rows_as_angle_values - rows_dist);
+            if (rows_dist < min_rows_dist && qAbs(cell.col - peak.col) < min_cols_dist) {
+                is_separated = false;
+                break;
+            }
+        }
+        if (is_separated) {
+            peaks.push_back(Peak(cell.row, cell.col, cell.value, RowAngleInDegr(cell.row), _min_radius + cell.col * _radius_step));
         }
     }
 }
 
-void HoughTransform::DeleteTable()
+template <typename Cell>
+void HoughTransform::FindLocalMaxInTable(double min_value, QVector<MaxCell> &local_maxes)
 {
-    for (int i = 0; i < _ROWS_AS_ANGLE_VALUES; ++i) {
-       delete []_matrix[i];
+    std::mutex maxes_mutex;
+    auto find_in_rows = [&](int row_begin, int row_end) {
+        QVector<MaxCell> rows_maxes;
+        for (int row = row_begin; row < row_end; ++row) {
+            const Cell *cells = Row<Cell>(row);
+            for (int col = 0; col < _columns_as_radius_values; ++col) {
+                if (cells[col] < min_value) continue;
+                MaxCell cell(cells[col], row, col);
+                //Из равных соседних ячеек максимумом считается одна (IsBetterThan учитывает порядок обхода)
+                bool is_local_max = true;
+                for (int n_row = qMax(0, row - 1); n_row <= qMin(_rows_as_angle_values - 1, row + 1); ++n_row) {
+                    const Cell *n_cells = Row<Cell>(n_row);
+                    for (int n_col = qMax(0, col - 1); n_col <= qMin(_columns_as_radius_values - 1, col + 1); ++n_col) {
+                        is_local_max &= (MaxCell(n_cells[n_col], n_row, n_col).IsBetterThan(cell) == false);
+                    }
+                }
+                if (is_local_max == true) rows_maxes.push_back(cell);
+            }
+        }
+        std::lock_guard<std::mutex> lock(maxes_mutex);
+        local_maxes += rows_maxes;
+    };
+    if (qint64(_rows_as_angle_values) * _columns_as_radius_values < _MIN_VOTES_FOR_PARALLEL) {
+        find_in_rows(0, _rows_as_angle_values);
+    } else {
+        _thread_pool.ParallelFor(0, _rows_as_angle_values, find_in_rows);
     }
-    delete []_matrix;
 }
 
-void HoughTransform::FindResult()
+void HoughTransform::RefineResult(const double *x, const double *y, const double *weights, int points_cnt,
+                                  int refine_factor)
 {
-    _row_of_max = 0;
-    _col_of_max = 0;
-    for (int row = 0; row < _ROWS_AS_ANGLE_VALUES; ++row) {
-        for (int col = 0; col < _columns_as_radius_values; ++col) {
-            if (_matrix[_row_of_max][_col_of_max] < _matrix[row][col]) {
-                _row_of_max = row;
-                _col_of_max = col;
+    if (_is_result_found == false) FindResult();
+    if (refine_factor <= 1) return;
+
+    //Мелкая сетка покрывает соседние с максимумом ячейки грубой таблицы: +-1 шаг по углу и по радиусу
+    const double coarse_angle_step = (_max_angle_in_degr - _min_angle_in_degr) / _rows_as_angle_values;
+    const double fine_angle_step = coarse_angle_step / refine_factor, fine_radius_step = _radius_step / refine_factor;
+    const int fine_size = 2*refine_factor + 1;
+    const double fine_min_angle = _res_angle_in_degr - coarse_angle_step, fine_min_radius = _res_radius - _radius_step;
+    QVector<double> fine_cos(fine_size), fine_sin(fine_size);
+    for (int row = 0; row < fine_size; ++row) {
+        double angle_in_rad = qDegreesToRadians(fine_min_angle + row*fine_angle_step);
+        fine_cos[row] = qCos(angle_in_rad);
+        fine_sin[row] = qSin(angle_in_rad);
+    }
+    QVector<double> fine_table(fine_size*fine_size, 0);
+
+    /* Голосуют только точки, которые могут попасть в окно: при повороте на угол d радиус точки
+     меняется не более чем на |(x,y)|*d */
+    const double coarse_angle_step_in_rad = qDegreesToRadians(coarse_angle_step);
+    const double peak_cos = _cos_vals[_row_of_max], peak_sin = _sin_vals[_row_of_max];
+    for (int i = 0; i < points_cnt; ++i) {
+        double dist_to_peak = qAbs(x[i]*peak_cos + y[i]*peak_sin - _res_radius);
+        double max_dist = 1.5*_radius_step + qSqrt(x[i]*x[i] + y[i]*y[i]) * coarse_angle_step_in_rad;
+        if (max_dist < dist_to_peak) continue;
+        double weight = (weights == nullptr)? 1: weights[i];
+        for (int row = 0; row < fine_size; ++row) {
+            double radius = x[i]*fine_cos[row] + y[i]*fine_sin[row];
+            int col = qRound((radius - fine_min_radius) / fine_radius_step);
+            if (0 <= col && col < fine_size) {
+                fine_table[row*fine_size + col] += weight;
             }
         }
     }
-    _res_angle_in_degr = _row_of_max; _res_radius = _col_of_max * _radius_step;
-    _is_result_found = true;
+
+    int fine_row_of_max = 0, fine_col_of_max = 0;
+    for (int row = 0; row < fine_size; ++row) {
+        for (int col = 0; col < fine_size; ++col) {
+            if (fine_table[fine_row_of_max*fine_size + fine_col_of_max] < fine_table[row*fine_size + col]) {
+                fine_row_of_max = row;
+                fine_col_of_max = col;
+            }
+        }
+    }
+    //Если в окно не попала ни одна точка, остаётся результат грубой таблицы
+    if (fine_table[fine_row_of_max*fine_size + fine_col_of_max] <= 0) return;
+
+    _res_angle_in_degr = fine_min_angle + fine_row_of_max*fine_angle_step;
+    _res_radius = fine_min_radius + fine_col_of_max*fine_radius_step;
+    /* Полоса принадлежности остаётся шириной в грубый шаг радиуса: уточнённая прямая сама несёт ошибку
+     до половины мелкой ячейки, и полоса в мелкий шаг отсекала бы точки, лежащие на прямой.
+     Единственная ячейка (col = 1) сетки из трёх столбцов с центром в уточнённом радиусе */
+    _line_cell = LineCell(fine_cos[fine_row_of_max], fine_sin[fine_row_of_max], _res_radius - _radius_step,
+                          _res_radius + _radius_step, _radius_step, 1);
+}
+
+double HoughTransform::PeakOffset(double prev, double curr, double next)
+{
+    double curvature = prev - 2*curr + next;
+    if (0 <= curvature) return 0;
+    return qBound(-0.5, 0.5*(prev - next)/curvature, 0.5);
+}
+
+void HoughTransform::InterpolateResult()
+{
+    if (_is_result_found == false) FindResult();
+
+    const int row = _row_of_max, col = _col_of_max;
+    double curr = CellValue(row, col);
+    //Для полной окружности соседи первой и последней строк берутся с другого края таблицы
+    double row_offset = 0;
+    if (IsFullCircle() || (0 < row && row < _rows_as_angle_values - 1)) {
+        int prev_row = (row + _rows_as_angle_values - 1) % _rows_as_angle_values,
+            next_row = (row + 1) % _rows_as_angle_values;
+        row_offset = PeakOffset(CellValue(prev_row, col), curr, CellValue(next_row, col));
+    }
+    double col_offset = 0;
+    if (0 < col && col < _columns_as_radius_values - 1) {
+        col_offset = PeakOffset(CellValue(row, col - 1), curr, CellValue(row, col + 1));
+    }
+
+    _res_angle_in_degr = RowAngleInDegr(row) + row_offset * (_max_angle_in_degr - _min_angle_in_degr) / _rows_as_angle_values;
+    _res_radius = _min_radius + (col + col_offset) * _radius_step;
+    double angle_in_rad = qDegreesToRadians(_res_angle_in_degr);
+    //Единственная ячейка (col = 1) сетки из трёх столбцов с центром в уточнённом радиусе
+    _line_cell = LineCell(qCos(angle_in_rad), qSin(angle_in_rad), _res_radius - _radius_step, _res_radius + _radius_step,
+                          _radius_step, 1);
+}
+
+template <typename Cell>
+HoughTransform::MaxCell HoughTransform::FindMaxInTable(int excl_row, int excl_col, int excl_radius)
+{
+    //Строки делятся между потоками, внутри строки максимум ищется векторными инструкциями
+    std::mutex max_mutex;
+    MaxCell table_max;
+    auto find_max_in_part = [&](int row, const Cell *cells, int col_begin, int col_end, MaxCell &rows_max) {
+        if (col_end <= col_begin) return;
+        int col = col_begin + FindMaxInRow(cells + col_begin, col_end - col_begin);
+        MaxCell cell(cells[col], row, col);
+        if (cell.IsBetterThan(rows_max)) rows_max = cell;
+    };
+    auto find_max_in_rows = [&](int row_begin, int row_end) {
+        MaxCell rows_max;
+        for (int row = row_begin; row < row_end; ++row) {
+            const Cell *cells = Row<Cell>(row);
+            if (qAbs(row - excl_row) <= excl_radius) {
+                //Исключаемые ячейки (окрестность известного максимума) пропускаются
+                find_max_in_part(row, cells, 0, qMin(excl_col - excl_radius, _columns_as_radius_values), rows_max);
+                find_max_in_part(row, cells, qMax(0, excl_col + excl_radius + 1), _columns_as_radius_values, rows_max);
+            } else {
+                find_max_in_part(row, cells, 0, _columns_as_radius_values, rows_max);
+            }
+        }
+        std::lock_guard<std::mutex> lock(max_mutex);
+        if (rows_max.IsBetterThan(table_max)) table_max = rows_max;
+    };
+    if (qint64(_rows_as_angle_values) * _columns_as_radius_values < _MIN_VOTES_FOR_PARALLEL) {
+        find_max_in_rows(0, _rows_as_angle_values);
+    } else {
+        _thread_pool.ParallelFor(0, _rows_as_angle_values, find_max_in_rows);
+    }
+    return table_max;
+}
+
+HoughTransform::MaxCell HoughTransform::FindMaxCell(int excl_row, int excl_col, int excl_radius)
+{
+    switch (_cell_type) {
+    case ctFLOAT: return FindMaxInTable<float>(excl_row, excl_col, excl_radius);
+    case ctINT32: return FindMaxInTable<int32_t>(excl_row, excl_col, excl_radius);
+    default: return FindMaxInTable<double>(excl_row, excl_col, excl_radius);
+    }
+}
+
+void HoughTransform::SetRandomSeed(unsigned seed)
+{
+    _random_gen.seed(seed);
+}
+
+int HoughTransform::AddRandomPoints(const double *x, const double *y, int points_cnt, double sample_fraction,
+                                    const double *normal_angles_in_degr)
+{
+    int sample_size = qMin(points_cnt, qMax(_MIN_RANDOM_PORTION, qCeil(sample_fraction * points_cnt)));
+    //Частичное перемешивание Фишера-Йетса: первые sample_size номеров образуют случайную выборку
+    _random_ids.resize(points_cnt);
+    for (int i = 0; i < points_cnt; ++i) {
+        _random_ids[i] = i;
+    }
+    _random_x.resize(sample_size);
+    _random_y.resize(sample_size);
+    _random_normals.resize((normal_angles_in_degr != nullptr)? sample_size: 0);
+    for (int i = 0; i < sample_size; ++i) {
+        std::uniform_int_distribution<int> distr(i, points_cnt - 1);
+        std::swap(_random_ids[i], _random_ids[distr(_random_gen)]);
+        _random_x[i] = x[_random_ids[i]];
+        _random_y[i] = y[_random_ids[i]];
+        if (normal_angles_in_degr != nullptr) _random_normals[i] = normal_angles_in_degr[_random_ids[i]];
+    }
+
+    //Порции удваиваются, поэтому проверок доминирования (просмотров таблицы) логарифмически мало
+    int voted_cnt = 0;
+    while (voted_cnt < sample_size) {
+        int portion_size = qMin(qMax(_MIN_RANDOM_PORTION, voted_cnt), sample_size - voted_cnt);
+        AddPoints(_random_x.constData() + voted_cnt, _random_y.constData() + voted_cnt, nullptr, portion_size,
+                  (normal_angles_in_degr != nullptr)? _random_normals.constData() + voted_cnt: nullptr);
+        voted_cnt += portion_size;
+        if (IsResultDominant() == true) break;
+    }
+    return voted_cnt;
+}
+
+bool HoughTransform::IsResultDominant()
+{
+    if (_is_result_found == false) FindResult();
+    /* Голоса ячейки примерно распределены по Пуассону: максимум считается доминирующим,
+     если он отличается от следующего за ним (вне окрестности максимума) более чем на _DOMINANCE_Z сигм */
+    double first_max = _max_cell.value;
+    if (first_max < _MIN_DOMINANT_VOTES) return false;
+    double second_max = qMax(0.0, FindMaxCell(_row_of_max, _col_of_max, _DOMINANCE_EXCL_RADIUS).value);
+    return _DOMINANCE_Z * qSqrt(first_max + second_max) < first_max - second_max;
 }
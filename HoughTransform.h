@@ -1,24 +1,112 @@
 #ifndef HOUGHTRANSFORM_H
 #define HOUGHTRANSFORM_H
 
+#include <limits>
+#include <random>
+
+#include <QVector>
+
+#include "ThreadPool.h"
+
 class HoughTransform
 {
 public:
+    //Тип ячейки таблицы: для голосования без весов достаточно ctFLOAT или ctINT32
+    enum CellType { ctDOUBLE, ctFLOAT, ctINT32 };
+
+    //Локальный максимум таблицы: ячейка (row, col) и соответствующая ей прямая
+    struct Peak
+    {
+        Peak(int row = -1, int col = -1, double votes = 0, double angle_in_degr = 0, double radius = 0)
+            : row(row), col(col), votes(votes), angle_in_degr(angle_in_degr), radius(radius) { }
+        int row, col;
+        double votes;
+        double angle_in_degr, radius;
+    };
+
     HoughTransform() { }
     HoughTransform(double arg_of_max_mod, double value_of_max_mod, double radius_step = 0.1);
     ~HoughTransform();
 
+    HoughTransform(const HoughTransform&) = delete;
+    HoughTransform& operator=(const HoughTransform&) = delete;
+
     void Init(double arg_of_max_abs, double value_of_max_abs, double radius_step = 0.1);
 
+    /* Параметры таблицы; после Init их изменение пересоздаёт таблицу (голоса теряются).
+     Углы строк: min + i*(max - min)/angles_cnt, i = 0..angles_cnt-1.
+     Если диапазон углов меньше 360, радиус может быть отрицательным */
+    void SetAngleRange(double min_angle_in_degr, double max_angle_in_degr, int angles_cnt);
+    //Шаг радиуса ограничивается диапазоном [min_radius_step, max_radius_step]
+    void SetRadiusStepRange(double min_radius_step, double max_radius_step);
+    void SetRadiusStep(double radius_step);
+
+    void SetCellType(CellType cell_type);
+    CellType GetCellType() const { return _cell_type; }
+
+    //Строки таблицы (углы) делятся между потоками; threads_cnt == 0: по числу ядер
+    void SetThreadsCnt(int threads_cnt) { _thread_pool.SetThreadsCnt(threads_cnt); }
+    int ThreadsCnt() const { return _thread_pool.ThreadsCnt(); }
+
     double GetMaxRadius() const { return _max_radius; }
+    double GetMinRadius() const { return _min_radius; }
     double GetRadiusStep() const { return _radius_step; }
+    double GetMinRadiusStep() const { return _min_radius_step; }
+    double GetMaxRadiusStep() const { return _max_radius_step; }
+    int AnglesCnt() const { return _rows_as_angle_values; }
 
     void AddPoint(double x, double y, double weight = 1);
+    //weights == nullptr: вес каждой точки равен 1
+    //normal_angles_in_degr: оценки нормали в точках для направленного голосования (см. SetOrientedVoting)
+    void AddPoints(const double *x, const double *y, const double *weights, int points_cnt,
+                   const double *normal_angles_in_degr = nullptr);
+    //Отмена голосов ранее добавленных точек (с теми же весами и нормалями)
+    void RemovePoint(double x, double y, double weight = 1);
+    void RemovePoints(const double *x, const double *y, const double *weights, int points_cnt,
+                      const double *normal_angles_in_degr = nullptr);
+
+    /* Направленное голосование: точка с известной нормалью голосует только в строках с углами
+     в пределах +-window_in_degr от нормали (и от противоположного направления). 0: во всех строках.
+     Нормаль NaN означает, что направление неизвестно */
+    void SetOrientedVoting(double window_in_degr);
+
+    /* Уточнение результата: точки около максимума таблицы повторно голосуют в мелкую локальную сетку
+     (шаги по углу и радиусу в refine_factor раз меньше). Принадлежность точек проверяется полосой шириной
+     в шаг радиуса таблицы около уточнённой прямой. Действует до следующего изменения таблицы */
+    void RefineResult(const double *x, const double *y, const double *weights, int points_cnt, int refine_factor);
+
+    /* Уточнение результата внутри ячейки: вершина параболы через максимум и соседние ячейки, отдельно
+     по углу и по радиусу. Принадлежность точек проверяется полосой шириной в шаг радиуса около уточнённой прямой.
+     Действует до следующего изменения таблицы */
+    void InterpolateResult();
+
+    /* Вероятностное голосование: случайная выборка из sample_fraction точек голосует порциями,
+     пока максимум не станет статистически доминирующим. Возвращает число проголосовавших точек.
+     Принадлежность точек прямой затем проверяется по всему набору. normal_angles_in_degr - как в AddPoints */
+    int AddRandomPoints(const double *x, const double *y, int points_cnt, double sample_fraction,
+                        const double *normal_angles_in_degr = nullptr);
+    void SetRandomSeed(unsigned seed);
+
+    /* Несколько прямых по одной таблице: до max_peaks_cnt локальных максимумов по убыванию голосов.
+     Максимум отбрасывается, если он ближе min_angle_dist_in_degr по углу и одновременно ближе min_radius_dist
+     по радиусу к уже выбранному, или если он набрал меньше min_rel_votes голосов главного максимума */
+    void FindPeaks(int max_peaks_cnt, double min_angle_dist_in_degr, double min_radius_dist, double min_rel_votes,
+                   QVector<Peak> &peaks);
+    /* Сделать результатом прямую найденного ранее максимума (в той же таблице), не просматривая таблицу.
+     Действует до следующего изменения таблицы */
+    void SelectPeak(const Peak &peak);
+    /* Максимум по-прежнему отделён: в его ячейке сейчас не меньше min_rel_votes голосов главного максимума.
+     Проверка нужна для максимумов, найденных до вычитания голосов (RemovePoints) */
+    bool IsPeakLive(const Peak &peak, double min_rel_votes);
 
     double GetNormalAngleInDegr();
     double GetNormalRadius();
 
     bool IsPointFromRecogLine(double x, double y);
+    //is_from_line[i] == IsPointFromRecogLine(x[i], y[i])
+    void FindPointsFromRecogLine(const double *x, const double *y, int points_cnt, bool *is_from_line);
+    //is_from_line[i]: расстояние от точки до распознанной прямой не больше max_dist (max_dist > 0)
+    void FindPointsNearRecogLine(const double *x, const double *y, int points_cnt, double max_dist, bool *is_from_line);
     double GetLineAngleCoef();
     double GetLineShift();
 
@@ -27,20 +115,99 @@ public:
     int ColumnsCnt() const { return _columns_as_radius_values; }
 
 private:
+    void InitTable();
+    void InitTrigTables();
     void CreateTable();
     void DeleteTable();
 
     void FindResult();
+    void SetResult(int row, int col);
+    double RowAngleInDegr(int row) const;
+    bool IsFullCircle() const { return _max_angle_in_degr - _min_angle_in_degr == 360; }
+
+    int CellSize() const;
+    template <typename Cell> Cell* Row(int row) const;
+    double CellValue(int row, int col) const;
+    //Смещение вершины параболы через (-1, prev), (0, curr), (1, next) в [-0.5, 0.5]; 0, если curr не максимум
+    static double PeakOffset(double prev, double curr, double next);
+    struct MaxCell
+    {
+        MaxCell(double value = std::numeric_limits<double>::lowest(), int row = -1, int col = -1)
+            : value(value), row(row), col(col) { }
+        //При равных значениях лучше ячейка, которая раньше встречается при обходе таблицы по строкам
+        bool IsBetterThan(const MaxCell &other) const
+        {
+            if (value != other.value) return other.value < value;
+            return row < other.row || (row == other.row && col < other.col);
+        }
+        double value;
+        int row, col;
+    };
+
+    void VotePoints(const double *x, const double *y, const double *weights, const double *normal_angles_in_degr,
+                    int points_cnt, double weight_sign);
+    template <typename Cell> void AddPointsToTable(const double *x, const double *y, const double *weights, int points_cnt,
+                                                   double weight_sign, bool is_max_tracked);
+    template <typename Cell> void AddOrientedPointsToTable(const double *x, const double *y, const double *weights,
+                                                           const double *normal_angles_in_degr, int points_cnt,
+                                                           double weight_sign, bool is_max_tracked);
+    template <typename Cell> MaxCell VoteInRows(int row_begin, int row_end,
+                                                const double *x, const double *y, const double *weights, int points_cnt,
+                                                double weight_sign, bool is_max_tracked);
+    //Поиск максимума вне квадратной окрестности ячейки (excl_row, excl_col)
+    MaxCell FindMaxCell(int excl_row = -1, int excl_col = -1, int excl_radius = -1);
+    template <typename Cell> MaxCell FindMaxInTable(int excl_row, int excl_col, int excl_radius);
+    //Ячейки не меньше min_value, лучше которых нет ни одной из 8 соседних
+    template <typename Cell> void FindLocalMaxInTable(double min_value, QVector<MaxCell> &local_maxes);
+    bool IsResultDominant();
 
     bool _is_result_found = false;
-    const double _MIN_RADIUS_STEP = 0.1, _MAX_RADIUS_STEP = 1;
+    double _min_radius_step = 0.1, _max_radius_step = 1;
     int _row_of_max, _col_of_max;
+    //Максимум таблицы, обновляемый при голосовании с неотрицательными весами
+    MaxCell _max_cell;
+    bool _is_max_tracked = false;
     double _res_angle_in_degr, _res_radius;
 
-    double **_matrix = nullptr;
-    const int _ROWS_AS_ANGLE_VALUES = 360;
-    int _columns_as_radius_values;
-    double _radius_step, _max_radius;
+    //Ячейка-победитель, по которой проверяется принадлежность точек распознанной прямой
+    struct LineCell
+    {
+        LineCell(double cos_val = 1, double sin_val = 0, double min_radius = 0, double max_radius = 0,
+                 double radius_step = 1, int col = -1)
+            : cos_val(cos_val), sin_val(sin_val), min_radius(min_radius), max_radius(max_radius),
+              radius_step(radius_step), col(col) { }
+        double cos_val, sin_val;
+        double min_radius, max_radius, radius_step;
+        int col;
+    };
+    LineCell _line_cell;
+
+    //Таблица хранится в едином выровненном буфере, строки дополнены до _row_stride ячеек
+    void *_cells = nullptr;
+    size_t _cells_capacity_in_bytes = 0;
+    static const size_t _CELLS_ALIGNMENT = 64;
+    CellType _cell_type = ctDOUBLE;
+    int _row_stride = 0;
+    //Точки голосуют блоками, чтобы координаты блока оставались в кэше при переборе строк
+    static const int _POINTS_BLOCK_SIZE = 1024;
+    //При меньшем числе голосов (точки * строки) потоки не используются
+    static const int _MIN_VOTES_FOR_PARALLEL = 1 << 16;
+    ThreadPool _thread_pool;
+
+    std::mt19937 _random_gen;
+    QVector<int> _random_ids;
+    QVector<double> _random_x, _random_y, _random_normals;
+    static const int _MIN_RANDOM_PORTION = 256;
+    static const int _MIN_DOMINANT_VOTES = 16;
+    static const int _DOMINANCE_EXCL_RADIUS = 2;
+    const double _DOMINANCE_Z = 3;
+    int _rows_as_angle_values = 360;
+    double _oriented_window_in_degr = 0;
+    double _min_angle_in_degr = 0, _max_angle_in_degr = 360;
+    //Значения cos и sin для каждой строки (угла) таблицы
+    QVector<double> _cos_vals, _sin_vals;
+    int _columns_as_radius_values = 0;
+    double _radius_step = 0.1, _min_radius = 0, _max_radius = 0;
 };
 
 #endif // HOUGHTRANSFORM_H
@@ -54,11 +54,7 @@ QVector<double> MainWindow::CalcCntlValuesForDraw(const QVector<double> &x_vals)
 {
     SugenoCntl &cntl = _builder->GetController();
     QVector<double> y_cntl_vals(x_vals.size());
-    for (int i = 0; i < y_cntl_vals.size(); ++i) {
-        double x = x_vals[i];
-        double y_cntl = cntl(x);
-        y_cntl_vals[i] = y_cntl;
-    }
+    cntl.Evaluate(x_vals.constData(), y_cntl_vals.data(), x_vals.size());
     return y_cntl_vals;
 }
 
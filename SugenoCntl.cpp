@@ -1,10 +1,48 @@
 #include <cmath>
 #include <cassert>
+#include <limits>
 #include <algorithm>
 
 #include "SugenoCntl.h"
 
-UnaryFunc SugenoCntl::GenTriangularFunc(const QVector<double> &values)
+const int SugenoCntl::_POINTS_BLOCK_SIZE;
+
+namespace {
+
+struct TriangularKernel
+{
+    static double Value(double dist, double scale, ExpAccuracy) { return std::max(1 - std::abs(dist) * scale, 0.0); }
+    static void Values(const double *xs, int points_cnt, double center, double scale, ExpAccuracy, double *values)
+    {
+        for (int i = 0; i < points_cnt; ++i) {
+            values[i] = Value(xs[i] - center, scale, eaEXACT);
+        }
+    }
+};
+
+struct NormalKernel
+{
+    static double Value(double dist, double scale, ExpAccuracy accuracy) { return CalcExp(-scale * dist*dist, accuracy); }
+    static void Values(const double *xs, int points_cnt, double center, double scale, ExpAccuracy accuracy, double *values)
+    {
+        CalcNormalValues(xs, points_cnt, center, scale, accuracy, values);
+    }
+};
+
+}
+
+void MemFuncParams::Values(const double *xs, int points_cnt, double *values, ExpAccuracy accuracy) const
+{
+    if (type == tNORMAL) {
+        CalcNormalValues(xs, points_cnt, center, M_PI / (width*width), accuracy, values);
+        return;
+    }
+    for (int i = 0; i < points_cnt; ++i) {
+        values[i] = (*this)(xs[i]);
+    }
+}
+
+MemFuncParams SugenoCntl::CalcTriangularParams(const QVector<double> &values)
 {
     auto it_to_min = std::min_element(values.begin(), values.end());
     auto it_to_max = std::max_element(values.begin(), values.end());
@@ -12,11 +50,10 @@ UnaryFunc SugenoCntl::GenTriangularFunc(const QVector<double> &values)
     double a = (*it_to_max + *it_to_min)/ 2,
             b = *it_to_max - *it_to_min;
     assert(b != 0);
-    auto f = [a,b](double x)->double { return std::max(1 - std::abs((x - a)/b), 0.0); };
-    return std::function<double(double)>(f);
+    return MemFuncParams(MemFuncParams::tTRIANGULAR, a, b);
 }
 
-UnaryFunc SugenoCntl::GenNormalFunc(const QVector<double> &values)
+MemFuncParams SugenoCntl::CalcNormalParams(const QVector<double> &values)
 {
     auto it_to_min = std::min_element(values.begin(), values.end());
     auto it_to_max = std::max_element(values.begin(), values.end());
@@ -24,8 +61,22 @@ UnaryFunc SugenoCntl::GenNormalFunc(const QVector<double> &values)
     double a = (*it_to_max + *it_to_min)/ 2,
             b = std::sqrt(M_PI/2) * (*it_to_max - *it_to_min);
     assert(b != 0);
-    auto f = [a,b](double x)->double { return std::pow(M_E, -M_PI * ((x - a)*(x - a))/(b*b)); };
-    return std::function<double(double)>(f);
+    return MemFuncParams(MemFuncParams::tNORMAL, a, b);
+}
+
+UnaryFunc SugenoCntl::GenMemFunc(const MemFuncParams &params)
+{
+    return std::function<double(double)>([params](double x)->double { return params(x); });
+}
+
+UnaryFunc SugenoCntl::GenTriangularFunc(const QVector<double> &values)
+{
+    return GenMemFunc(CalcTriangularParams(values));
+}
+
+UnaryFunc SugenoCntl::GenNormalFunc(const QVector<double> &values)
+{
+    return GenMemFunc(CalcNormalParams(values));
 }
 
 SugenoCntl::SugenoCntl()
@@ -39,6 +90,194 @@ void SugenoCntl::AddRule(UnaryFunc m_func, UnaryFunc linear_func)
     _rules.push_back(rule);
 }
 
+void SugenoCntl::AddRule(const MemFuncParams &m_params, double slope, double shift)
+{
+    assert(m_params.width != 0);
+    if (m_params.type == MemFuncParams::tTRIANGULAR) {
+        _triangular_rules.Add(m_params.center, 1 / std::abs(m_params.width), slope, shift);
+    } else {
+        _normal_rules.Add(m_params.center, M_PI / (m_params.width*m_params.width), slope, shift);
+    }
+    _is_support_index_actual = false;
+}
+
+double SugenoCntl::MinRuleWidth() const
+{
+    //scale - 1/width для треугольных правил и pi/width^2 для нормальных
+    double max_tri_scale = 0, max_normal_scale = 0;
+    for (double scale: _triangular_rules.scales) max_tri_scale = std::max(max_tri_scale, scale);
+    for (double scale: _normal_rules.scales) max_normal_scale = std::max(max_normal_scale, scale);
+    double min_width = std::numeric_limits<double>::infinity();
+    if (0 < max_tri_scale) min_width = std::min(min_width, 1 / max_tri_scale);
+    if (0 < max_normal_scale) min_width = std::min(min_width, std::sqrt(M_PI / max_normal_scale));
+    return min_width;
+}
+
+void SugenoCntl::CalcDerivBounds(double x_begin, double x_end, double &max_abs_deriv1, double &max_abs_deriv2) const
+{
+    /* y = sum(m_i*l_i) / D, D = sum(m_i), l_i = slope_i*x + shift_i:
+     y' = (sum(m_i'*(l_i - y)) + sum(m_i*slope_i)) / D,
+     y'' = (sum(m_i''*(l_i - y)) + 2*sum(m_i'*(slope_i - y'))) / D.
+     y - взвешенное среднее l_i, поэтому |l_i - y| не больше разброса l_i на отрезке, а второе слагаемое y'
+     не больше наибольшего |slope_i|. |m_i|, |m_i'|, |m_i''| оцениваются сверху, D - снизу по расстояниям
+     от центров правил до отрезка */
+    assert(x_begin <= x_end);
+    const double inf = std::numeric_limits<double>::infinity();
+    max_abs_deriv1 = max_abs_deriv2 = inf;
+    if (HasFuncRules() == true) return;
+
+    double min_denom = 0, sum_deriv1 = 0, sum_deriv1_slope = 0, sum_deriv2 = 0, max_slope = 0;
+    double min_linear = inf, max_linear = -inf;
+    bool is_kink_inside = false;
+    auto add_rule = [&](double max_m, double min_m, double max_deriv1, double max_deriv2, double slope, double shift) {
+        if (max_m == 0 && max_deriv1 == 0) return;
+        min_denom += min_m;
+        sum_deriv1 += max_deriv1;
+        sum_deriv1_slope += max_deriv1 * std::abs(slope);
+        sum_deriv2 += max_deriv2;
+        max_slope = std::max(max_slope, std::abs(slope));
+        min_linear = std::min({ min_linear, slope*x_begin + shift, slope*x_end + shift });
+        max_linear = std::max({ max_linear, slope*x_begin + shift, slope*x_end + shift });
+    };
+    //Наименьшее и наибольшее расстояние от center до точек отрезка
+    auto dist_range = [x_begin, x_end](double center, double &min_dist, double &max_dist) {
+        min_dist = (center < x_begin)? x_begin - center: (x_end < center)? center - x_end: 0;
+        max_dist = std::max(std::abs(x_begin - center), std::abs(x_end - center));
+    };
+
+    for (int i = 0; i < _triangular_rules.Size(); ++i) {
+        //m = max(1 - scale*d, 0): |m'| = scale внутри носителя, m'' = 0 вне изломов в center и center +- width
+        const double center = _triangular_rules.centers[i], scale = _triangular_rules.scales[i];
+        double min_dist, max_dist;
+        dist_range(center, min_dist, max_dist);
+        for (double kink: { center - 1/scale, center, center + 1/scale }) {
+            if (x_begin < kink && kink < x_end) is_kink_inside = true;
+        }
+        add_rule(std::max(1 - scale*min_dist, 0.0), std::max(1 - scale*max_dist, 0.0),
+                 (min_dist*scale < 1)? scale: 0, 0, _triangular_rules.slopes[i], _triangular_rules.shifts[i]);
+    }
+    for (int i = 0; i < _normal_rules.Size(); ++i) {
+        /* m = exp(-scale*d^2), |m'| = 2*scale*d*m растёт до d = 1/sqrt(2*scale) и затем убывает,
+         |m''| = |4*scale^2*d^2 - 2*scale|*m: экстремумы при d = 0 (концы) и d = sqrt(1.5/scale) */
+        const double scale = _normal_rules.scales[i];
+        double min_dist, max_dist;
+        dist_range(_normal_rules.centers[i], min_dist, max_dist);
+        auto m_func = [scale](double dist) { return std::exp(-scale * dist*dist); };
+        auto deriv1 = [&](double dist) { return 2*scale*dist * m_func(dist); };
+        auto deriv2 = [&](double dist) { return std::abs(4*scale*scale*dist*dist - 2*scale) * m_func(dist); };
+        double max_deriv1 = deriv1(std::min(std::max(1 / std::sqrt(2*scale), min_dist), max_dist));
+        double max_deriv2 = std::max(deriv2(min_dist), deriv2(max_dist));
+        const double extr_dist = std::sqrt(1.5 / scale);
+        if (min_dist < extr_dist && extr_dist < max_dist) max_deriv2 = std::max(max_deriv2, deriv2(extr_dist));
+        add_rule(m_func(min_dist), m_func(max_dist), max_deriv1, max_deriv2,
+                 _normal_rules.slopes[i], _normal_rules.shifts[i]);
+    }
+    if (min_denom <= 0) return;
+
+    const double spread = max_linear - min_linear;
+    max_abs_deriv1 = (sum_deriv1*spread) / min_denom + max_slope;
+    if (is_kink_inside == false) {
+        max_abs_deriv2 = (sum_deriv2*spread + 2*(sum_deriv1_slope + sum_deriv1*max_abs_deriv1)) / min_denom;
+    }
+}
+
+void SugenoCntl::SetSparseRuleLookup(bool is_enabled, double normal_eps)
+{
+    assert(0 < normal_eps && normal_eps < 1);
+    _is_lookup_sparse = is_enabled;
+    _normal_eps = normal_eps;
+    _is_support_index_actual = false;
+}
+
+void SugenoCntl::BuildSupportIndex()
+{
+    //Носитель треугольной функции: |x - center| < width; нормальной: exp(-scale*d^2) >= normal_eps
+    const int tri_cnt = _triangular_rules.Size(), rules_cnt = tri_cnt + _normal_rules.Size();
+    const double normal_dist_sqr = std::log(1 / _normal_eps);
+    QVector<double> lows(rules_cnt), highs(rules_cnt);
+    for (int rule_id = 0; rule_id < rules_cnt; ++rule_id) {
+        bool is_tri = (rule_id < tri_cnt);
+        const CompiledRules &rules = is_tri? _triangular_rules: _normal_rules;
+        int id = is_tri? rule_id: rule_id - tri_cnt;
+        double half_width = is_tri? 1 / rules.scales[id]: std::sqrt(normal_dist_sqr / rules.scales[id]);
+        lows[rule_id] = rules.centers[id] - half_width;
+        highs[rule_id] = rules.centers[id] + half_width;
+    }
+
+    QVector<double> &bounds = _support_index.bounds;
+    bounds = lows;
+    bounds += highs;
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    const int segments_cnt = bounds.size() + 1;
+
+    //Носитель [bounds[a], bounds[b]] покрывает отрезки с a + 1 по b
+    auto bound_id = [&bounds](double bound)->int {
+        return std::lower_bound(bounds.begin(), bounds.end(), bound) - bounds.begin();
+    };
+    QVector<int> &offsets = _support_index.offsets;
+    offsets.fill(0, segments_cnt + 1);
+    QVector<int> first_segments(rules_cnt), last_segments(rules_cnt);
+    for (int rule_id = 0; rule_id < rules_cnt; ++rule_id) {
+        first_segments[rule_id] = bound_id(lows[rule_id]) + 1;
+        last_segments[rule_id] = bound_id(highs[rule_id]);
+        for (int segment = first_segments[rule_id]; segment <= last_segments[rule_id]; ++segment) {
+            ++offsets[segment + 1];
+        }
+    }
+    for (int segment = 0; segment < segments_cnt; ++segment) {
+        offsets[segment + 1] += offsets[segment];
+    }
+    QVector<int> &rule_ids = _support_index.rule_ids;
+    rule_ids.resize(offsets[segments_cnt]);
+    QVector<int> fill_pos = offsets;
+    for (int rule_id = 0; rule_id < rules_cnt; ++rule_id) {
+        for (int segment = first_segments[rule_id]; segment <= last_segments[rule_id]; ++segment) {
+            rule_ids[fill_pos[segment]++] = rule_id;
+        }
+    }
+    _is_support_index_actual = true;
+}
+
+void SugenoCntl::AccumulateActiveRules(const double *xs, int points_cnt, double *numerators, double *denominators)
+{
+    if (_is_support_index_actual == false) BuildSupportIndex();
+
+    const QVector<double> &bounds = _support_index.bounds;
+    const int tri_cnt = _triangular_rules.Size();
+    for (int i = 0; i < points_cnt; ++i) {
+        const double x = xs[i];
+        int segment = std::upper_bound(bounds.begin(), bounds.end(), x) - bounds.begin();
+        for (int pos = _support_index.offsets[segment]; pos < _support_index.offsets[segment + 1]; ++pos) {
+            int rule_id = _support_index.rule_ids[pos];
+            bool is_tri = (rule_id < tri_cnt);
+            const CompiledRules &rules = is_tri? _triangular_rules: _normal_rules;
+            int id = is_tri? rule_id: rule_id - tri_cnt;
+            double dist = x - rules.centers[id];
+            double m_func_val = is_tri? TriangularKernel::Value(dist, rules.scales[id], _exp_accuracy):
+                                        NormalKernel::Value(dist, rules.scales[id], _exp_accuracy);
+            numerators[i] += m_func_val * (rules.slopes[id]*x + rules.shifts[id]);
+            denominators[i] += m_func_val;
+        }
+    }
+}
+
+void SugenoCntl::CompiledRules::Add(double center, double scale, double slope, double shift)
+{
+    centers.push_back(center);
+    scales.push_back(scale);
+    slopes.push_back(slope);
+    shifts.push_back(shift);
+}
+
+void SugenoCntl::CompiledRules::Clear()
+{
+    centers.clear();
+    scales.clear();
+    slopes.clear();
+    shifts.clear();
+}
+
 bool SugenoCntl::IsLastResValid() const
 {
     return _validity_flag;
@@ -47,27 +286,73 @@ bool SugenoCntl::IsLastResValid() const
 void SugenoCntl::Clear()
 {
     _rules.clear();
+    _triangular_rules.Clear();
+    _normal_rules.Clear();
+    _is_support_index_actual = false;
     _validity_flag = true;
 }
 
 double SugenoCntl::operator()(double x)
 {
-    bool has_active_rules = false;
-    double numerator(0), denominator(0);
-    for (int i = 0; i < _rules.size(); ++i) {
-        double m_func_val = _rules[i].m_func(x);
-        bool is_active = m_func_val > 0;
-        if (is_active) {
-            has_active_rules = true;
-            numerator += m_func_val * _rules[i].linear_func(x);
-            denominator += m_func_val;
+    double y;
+    Evaluate(&x, &y, 1);
+    return y;
+}
+
+void SugenoCntl::AccumulateFuncRules(const double *xs, int points_cnt, double *numerators, double *denominators)
+{
+    //Внешний цикл по правилам: функции правила вызываются подряд для всех точек блока
+    for (int rule_id = 0; rule_id < _rules.size(); ++rule_id) {
+        Rule &rule = _rules[rule_id];
+        for (int i = 0; i < points_cnt; ++i) {
+            double m_func_val = rule.m_func(xs[i]);
+            if (m_func_val > 0) {
+                numerators[i] += m_func_val * rule.linear_func(xs[i]);
+                denominators[i] += m_func_val;
+            }
         }
     }
-    if (has_active_rules == true) {
-        _validity_flag = true;
-        return numerator / denominator;
-    } else {
-        _validity_flag = false;
-        return 0;
+}
+
+/* Степени принадлежности неотрицательны, поэтому неактивные правила (значение 0) можно прибавлять без проверки:
+ тело цикла без ветвлений и виртуальных вызовов векторизуется компилятором */
+template <typename Kernel>
+void SugenoCntl::AccumulateCompiledRules(const CompiledRules &rules, const double *xs, int points_cnt,
+                                         double *numerators, double *denominators)
+{
+    double m_func_vals[_POINTS_BLOCK_SIZE];
+    for (int rule_id = 0; rule_id < rules.Size(); ++rule_id) {
+        const double slope = rules.slopes[rule_id], shift = rules.shifts[rule_id];
+        Kernel::Values(xs, points_cnt, rules.centers[rule_id], rules.scales[rule_id], _exp_accuracy, m_func_vals);
+        for (int i = 0; i < points_cnt; ++i) {
+            numerators[i] += m_func_vals[i] * (slope*xs[i] + shift);
+            denominators[i] += m_func_vals[i];
+        }
+    }
+}
+
+void SugenoCntl::Evaluate(const double *xs, double *ys, int points_cnt, bool *is_valid)
+{
+    double numerators[_POINTS_BLOCK_SIZE], denominators[_POINTS_BLOCK_SIZE];
+    for (int block_start = 0; block_start < points_cnt; block_start += _POINTS_BLOCK_SIZE) {
+        const int block_size = std::min(_POINTS_BLOCK_SIZE, points_cnt - block_start);
+        const double *block_xs = xs + block_start;
+        std::fill(numerators, numerators + block_size, 0.0);
+        std::fill(denominators, denominators + block_size, 0.0);
+        AccumulateFuncRules(block_xs, block_size, numerators, denominators);
+        if (_is_lookup_sparse == true) {
+            AccumulateActiveRules(block_xs, block_size, numerators, denominators);
+        } else {
+            AccumulateCompiledRules<TriangularKernel>(_triangular_rules, block_xs, block_size, numerators, denominators);
+            AccumulateCompiledRules<NormalKernel>(_normal_rules, block_xs, block_size, numerators, denominators);
+        }
+        //Сумма положительных степеней принадлежности положительна тогда и только тогда, когда есть активное правило
+        for (int i = 0; i < block_size; ++i) {
+            bool has_active_rules = (denominators[i] > 0);
+            ys[block_start + i] = has_active_rules? numerators[i] / denominators[i]: 0;
+            if (is_valid != nullptr) is_valid[block_start + i] = has_active_rules;
+        }
     }
+    //Как после последовательных вызовов operator(): признак относится к последней точке
+    if (0 < points_cnt) _validity_flag = (denominators[(points_cnt - 1) % _POINTS_BLOCK_SIZE] > 0);
 }
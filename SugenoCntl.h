@@ -1,8 +1,12 @@
 #ifndef SUGENOCNTL_H
 #define SUGENOCNTL_H
 
+#include <cmath>
+#include <algorithm>
+
 #include <QVector>
 #include "UnaryFunc.h"
+#include "ExpKernels.h"
 
 struct Rule
 {
@@ -10,23 +14,104 @@ struct Rule
     UnaryFunc linear_func;
 };
 
+//Параметрическая функция принадлежности (см. SugenoCntl::GenTriangularFunc, SugenoCntl::GenNormalFunc)
+struct MemFuncParams
+{
+    enum Type { tTRIANGULAR, tNORMAL };
+
+    MemFuncParams(Type type = tNORMAL, double center = 0, double width = 1)
+        : type(type), center(center), width(width) { }
+    double operator()(double x, ExpAccuracy accuracy = eaEXACT) const
+    {
+        double dist = (x - center) / width;
+        if (type == tTRIANGULAR) return std::max(1 - std::abs(dist), 0.0);
+        return (accuracy == eaEXACT)? std::exp(-M_PI * dist*dist): CalcExp(-M_PI * dist*dist, accuracy);
+    }
+    //values[i] = (*this)(xs[i], accuracy) для группы точек
+    void Values(const double *xs, int points_cnt, double *values, ExpAccuracy accuracy = eaEXACT) const;
+
+    Type type;
+    double center, width;
+};
+
 class SugenoCntl : public UnaryFuncBase
 {
 public:
     static UnaryFunc GenTriangularFunc(const QVector<double> &values);
     static UnaryFunc GenNormalFunc(const QVector<double> &values);
+    //Параметры тех же функций, что строят GenTriangularFunc и GenNormalFunc
+    static MemFuncParams CalcTriangularParams(const QVector<double> &values);
+    static MemFuncParams CalcNormalParams(const QVector<double> &values);
+    static UnaryFunc GenMemFunc(const MemFuncParams &params);
 
     SugenoCntl();
 
-    int RulesCnt() const { return _rules.size(); }
+    int RulesCnt() const { return _rules.size() + _triangular_rules.Size() + _normal_rules.Size(); }
     void AddRule(UnaryFunc m_func, UnaryFunc linear_func);
+    /* Правило с параметрической функцией принадлежности и следствием slope*x + shift.
+     Хранится в плоских массивах и вычисляется без виртуальных вызовов */
+    void AddRule(const MemFuncParams &m_params, double slope, double shift);
     double operator()(double x) override;
     bool IsLastResValid() const override;
+    /* ys[i] = (*this)(xs[i]); is_valid[i] - признак, что для xs[i] есть активное правило (is_valid может быть nullptr).
+     Правила применяются ко всему блоку точек сразу, а не к каждой точке по отдельности */
+    void Evaluate(const double *xs, double *ys, int points_cnt, bool *is_valid = nullptr);
+    /* Поиск активных параметрических правил по носителям функций принадлежности: для точки вычисляются только
+     правила, носитель которых её содержит, поэтому время не зависит от общего числа правил.
+     Значения нормальной функции меньше normal_eps (0 < normal_eps < 1) при этом считаются нулём */
+    void SetSparseRuleLookup(bool is_enabled, double normal_eps = 1e-9);
+    bool IsRuleLookupSparse() const { return _is_lookup_sparse; }
+    double GetNormalEps() const { return _normal_eps; }
+    //Точность экспоненты в нормальных функциях параметрических правил
+    void SetExpAccuracy(ExpAccuracy accuracy) { _exp_accuracy = accuracy; }
+    ExpAccuracy GetExpAccuracy() const { return _exp_accuracy; }
+    //Наименьшая ширина (MemFuncParams::width) параметрических правил; бесконечность, если их нет
+    double MinRuleWidth() const;
+    //Есть правила, заданные UnaryFunc: их производные неизвестны
+    bool HasFuncRules() const { return _rules.isEmpty() == false; }
+    /* Верхние границы |y'| и |y''| на [x_begin, x_end] для точного вычисления (std::exp, без поиска по носителям),
+     выведенные из параметров правил. Бесконечность, если граница не существует: есть правила, заданные UnaryFunc,
+     часть отрезка вне носителей всех правил или (только для y'') излом треугольной функции внутри отрезка */
+    void CalcDerivBounds(double x_begin, double x_end, double &max_abs_deriv1, double &max_abs_deriv2) const;
 
     void Clear();
 
 private:
+    //Параметры правил одного типа функции принадлежности, по массиву на параметр
+    struct CompiledRules
+    {
+        void Add(double center, double scale, double slope, double shift);
+        void Clear();
+        int Size() const { return centers.size(); }
+
+        //scale: 1/width для треугольной функции, pi/width^2 для нормальной
+        QVector<double> centers, scales, slopes, shifts;
+    };
+
+    /* Границы носителей правил по возрастанию делят ось на отрезки [bounds[k-1], bounds[k]),
+     правила k-го отрезка - rule_ids[offsets[k]]..rule_ids[offsets[k+1] - 1].
+     Номер правила: сначала треугольные правила, затем нормальные */
+    struct SupportIndex
+    {
+        QVector<double> bounds;
+        QVector<int> offsets, rule_ids;
+    };
+
+    void BuildSupportIndex();
+    void AccumulateFuncRules(const double *xs, int points_cnt, double *numerators, double *denominators);
+    void AccumulateActiveRules(const double *xs, int points_cnt, double *numerators, double *denominators);
+    template <typename Kernel> void AccumulateCompiledRules(const CompiledRules &rules, const double *xs, int points_cnt,
+                                                            double *numerators, double *denominators);
+
+    //Точки обрабатываются блоками, чтобы промежуточные суммы блока оставались в кэше
+    static const int _POINTS_BLOCK_SIZE = 1024;
+
     QVector<Rule> _rules;
+    CompiledRules _triangular_rules, _normal_rules;
+    bool _is_lookup_sparse = false, _is_support_index_actual = false;
+    double _normal_eps = 1e-9;
+    ExpAccuracy _exp_accuracy = eaEXACT;
+    SupportIndex _support_index;
     bool _validity_flag;
 };
 
@@ -0,0 +1,112 @@
+#include <cassert>
+
+#include <QtGlobal>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads_cnt)
+{
+    SetThreadsCnt(threads_cnt);
+}
+
+ThreadPool::~ThreadPool()
+{
+    StopWorkers();
+}
+
+void ThreadPool::SetThreadsCnt(int threads_cnt)
+{
+    assert(0 <= threads_cnt);
+    if (threads_cnt == 0) {
+        threads_cnt = qMax(1, int(std::thread::hardware_concurrency()));
+    }
+    if (threads_cnt == _threads_cnt && int(_workers.size()) == _threads_cnt - 1) return;
+
+    StopWorkers();
+    _threads_cnt = threads_cnt;
+    StartWorkers();
+}
+
+void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int, int)> &body)
+{
+    if (end <= begin) return;
+    if (_workers.empty() || end - begin == 1) {
+        body(begin, end);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _body = &body;
+        _begin = begin;
+        _end = end;
+        _unfinished_parts = int(_workers.size());
+        ++_task_generation;
+    }
+    _task_cond.notify_all();
+
+    //Вызывающий поток обрабатывает первую часть
+    RunPart(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cond.wait(lock, [this]() { return _unfinished_parts == 0; });
+    _body = nullptr;
+}
+
+void ThreadPool::StartWorkers()
+{
+    _is_stopping = false;
+    for (int part_id = 1; part_id < _threads_cnt; ++part_id) {
+        _workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, part_id, _task_generation));
+    }
+}
+
+void ThreadPool::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _is_stopping = true;
+    }
+    _task_cond.notify_all();
+    for (std::thread &worker: _workers) {
+        worker.join();
+    }
+    _workers.clear();
+}
+
+void ThreadPool::WorkerLoop(int part_id, unsigned done_generation)
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _task_cond.wait(lock, [this, done_generation]() {
+                return _is_stopping == true || _task_generation != done_generation;
+            });
+            if (_is_stopping == true) return;
+            done_generation = _task_generation;
+        }
+
+        RunPart(part_id);
+
+        bool is_last_part = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_unfinished_parts;
+            is_last_part = (_unfinished_parts == 0);
+        }
+        if (is_last_part == true) {
+            _done_cond.notify_one();
+        }
+    }
+}
+
+void ThreadPool::RunPart(int part_id)
+{
+    //Части отличаются по размеру не более чем на один элемент
+    long long size = _end - _begin;
+    int part_begin = _begin + int(size * part_id / _threads_cnt),
+        part_end = _begin + int(size * (part_id + 1) / _threads_cnt);
+    if (part_begin < part_end) {
+        (*_body)(part_begin, part_end);
+    }
+}
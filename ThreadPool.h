@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+class ThreadPool
+{
+public:
+    //threads_cnt == 0: по числу ядер процессора
+    explicit ThreadPool(int threads_cnt = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void SetThreadsCnt(int threads_cnt);
+    int ThreadsCnt() const { return _threads_cnt; }
+
+    /* Делит диапазон [begin, end) на ThreadsCnt() непрерывных частей и вызывает body(part_begin, part_end)
+     для каждой части в своём потоке (одна часть выполняется в вызывающем потоке). Возврат после завершения всех частей */
+    void ParallelFor(int begin, int end, const std::function<void(int, int)> &body);
+
+private:
+    void StartWorkers();
+    void StopWorkers();
+    void WorkerLoop(int part_id, unsigned done_generation);
+    void RunPart(int part_id);
+
+    int _threads_cnt = 1;
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _task_cond, _done_cond;
+    //Номер текущего задания: рабочий поток берёт задание, если номер изменился
+    unsigned _task_generation = 0;
+    int _unfinished_parts = 0;
+    bool _is_stopping = false;
+
+    const std::function<void(int, int)> *_body = nullptr;
+    int _begin = 0, _end = 0;
+};
+
+#endif // THREADPOOL_H